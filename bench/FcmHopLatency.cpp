@@ -0,0 +1,306 @@
+// ---------------------------------------------------------------------------------------------------------------------
+// Hop latency of a message between the components of two devices, for each wait strategy of the device thread, with
+// and without pinning the device threads. A driver triggers one round trip at a time with a gap in between, so the
+// device threads are idle when a message arrives, as on a lightly loaded device. The hop latency is half the round
+// trip.
+//
+//     g++ -std=c++17 -O2 -Iinc src/*.cpp bench/FcmHopLatency.cpp -pthread -o hop_latency
+//     ./hop_latency [roundTrips] [gapMicroseconds]
+//
+// BusyPoll occupies a core per device thread, on a machine with fewer than three cores its numbers are meaningless.
+// ---------------------------------------------------------------------------------------------------------------------
+#include <cmath>
+#include <thread>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include "FcmDevice.h"
+#include "FcmPlacementPlanner.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // -----------------------------------------------------------------------------------------------------------------
+    FCM_SET_INTERFACE(Hop,
+        FCM_DEFINE_MESSAGE( Ping, int64_t sendTime{}; );
+        FCM_DEFINE_MESSAGE( Pong, int64_t sendTime{}; );
+    );
+
+    FCM_SET_INTERFACE(Trigger,
+        FCM_DEFINE_MESSAGE( Start );
+    );
+
+    // -----------------------------------------------------------------------------------------------------------------
+    int64_t getTime()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // The round trips are only recorded by the device thread of the pinger, the driver waits for the count.
+    // -----------------------------------------------------------------------------------------------------------------
+    struct HopContext
+    {
+        std::vector<int64_t> roundTrips;
+        std::atomic<size_t> completedCount{0};
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+    FCM_FUNCTIONAL_COMPONENT(Pinger,
+        HopContext* context = nullptr;
+    );
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void Pinger::setStates()
+    {
+        setSetting("hopContext", context);
+        states = {"Idle"};
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void Pinger::setChoicePoints()
+    {
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void Pinger::setTransitions()
+    {
+        addTransitionFunction<Trigger::Start>("Idle", "Idle", [this](const Trigger::Start&)
+        {
+            auto ping = prepareMessage<Hop::Ping>();
+            ping->sendTime = getTime();
+            sendMessage(ping);
+        });
+
+        addTransitionFunction<Hop::Pong>("Idle", "Idle", [this](const Hop::Pong& pong)
+        {
+            context->roundTrips.push_back(getTime() - pong.sendTime);
+            context->completedCount.fetch_add(1, std::memory_order_release);
+        });
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void Pinger::initialize()
+    {
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    FCM_FUNCTIONAL_COMPONENT(Ponger);
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void Ponger::setStates()
+    {
+        states = {"Idle"};
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void Ponger::setChoicePoints()
+    {
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void Ponger::setTransitions()
+    {
+        addTransitionFunction<Hop::Ping>("Idle", "Idle", [this](const Hop::Ping& ping)
+        {
+            auto pong = prepareMessage<Hop::Pong>();
+            pong->sendTime = ping.sendTime;
+            sendMessage(pong);
+        });
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void Ponger::initialize()
+    {
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    FCM_ASYNC_INTERFACE_HANDLER(Driver,
+        void trigger() { sendMessage(prepareMessage<Trigger::Start>()); }
+    );
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void Driver::initialize()
+    {
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    struct BenchmarkConfig
+    {
+        FcmWaitStrategy waitStrategy;
+        std::optional<int> cpu;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+    class HopDevice : public FcmDevice
+    {
+    public:
+        std::shared_ptr<Pinger> pinger;
+        std::shared_ptr<Ponger> ponger;
+        std::shared_ptr<Driver> driver;
+
+        HopDevice(HopContext* contextParam, bool pingingParam, const BenchmarkConfig& configParam):
+            context(contextParam),
+            pinging(pingingParam),
+            config(configParam)
+        {
+        }
+
+        // -------------------------------------------------------------------------------------------------------------
+        void initialize() override
+        {
+            settings["hopContext"] = context;
+            setWaitStrategy(config.waitStrategy);
+            if (config.cpu.has_value())
+            {
+                setCpuAffinity(config.cpu.value());
+            }
+
+            if (pinging)
+            {
+                pinger = createComponent<Pinger>("Pinger", settings);
+                driver = createComponent<Driver>("Driver", settings);
+                connectInterface<Trigger>(driver, pinger);
+            }
+            else
+            {
+                ponger = createComponent<Ponger>("Ponger", settings);
+            }
+            initializeComponents();
+        }
+
+    private:
+        HopContext* context;
+        bool pinging;
+        BenchmarkConfig config;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+    struct HopReport
+    {
+        double mean = 0;
+        double p50 = 0;
+        double p99 = 0;
+        double maxLatency = 0;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+    double getPercentile(const std::vector<int64_t>& sortedHops, double fraction)
+    {
+        auto rank = static_cast<size_t>(std::ceil(fraction * static_cast<double>(sortedHops.size())));
+        return static_cast<double>(sortedHops[std::clamp<size_t>(rank, 1, sortedHops.size()) - 1]) / 1000;
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    HopReport measure(const BenchmarkConfig& pingConfig,
+                      const BenchmarkConfig& pongConfig,
+                      size_t roundTrips,
+                      std::chrono::microseconds gap)
+    {
+        HopContext context;
+        context.roundTrips.reserve(roundTrips + 1000);
+
+        HopDevice pingDevice(&context, true, pingConfig);
+        HopDevice pongDevice(&context, false, pongConfig);
+        pingDevice.initialize();
+        pongDevice.initialize();
+        FcmDevice::connectInterface<Hop>(pingDevice.pinger.get(), pongDevice.ponger.get());
+
+        std::thread pingThread([&pingDevice]() { pingDevice.runUntilStopped(); });
+        std::thread pongThread([&pongDevice]() { pongDevice.runUntilStopped(); });
+
+        // The first round trips warm up the caches and the branch predictors, they are not measured.
+        size_t warmupCount = std::min<size_t>(roundTrips / 10, 1000);
+        for (size_t roundTrip = 0; roundTrip < warmupCount + roundTrips; roundTrip++)
+        {
+            pingDevice.driver->trigger();
+            while (context.completedCount.load(std::memory_order_acquire) <= roundTrip)
+            {
+                std::this_thread::yield();
+            }
+            std::this_thread::sleep_for(gap);
+        }
+
+        pingDevice.stop();
+        pongDevice.stop();
+        pingThread.join();
+        pongThread.join();
+
+        std::vector<int64_t> hops;
+        for (size_t roundTrip = warmupCount; roundTrip < context.roundTrips.size(); roundTrip++)
+        {
+            hops.push_back(context.roundTrips[roundTrip] / 2);
+        }
+        std::sort(hops.begin(), hops.end());
+
+        HopReport report;
+        double total = 0;
+        for (auto hop : hops)
+        {
+            total += static_cast<double>(hop);
+        }
+        report.mean = total / static_cast<double>(hops.size()) / 1000;
+        report.p50 = getPercentile(hops, 0.5);
+        report.p99 = getPercentile(hops, 0.99);
+        report.maxLatency = static_cast<double>(hops.back()) / 1000;
+        return report;
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    const char* getStrategyName(FcmWaitStrategy waitStrategy)
+    {
+        switch (waitStrategy)
+        {
+            case FcmWaitStrategy::Block:
+                return "Block";
+            case FcmWaitStrategy::SpinThenBlock:
+                return "SpinThenBlock";
+            case FcmWaitStrategy::BusyPoll:
+                return "BusyPoll";
+        }
+        return "";
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    size_t roundTrips = argc > 1 ? std::stoul(argv[1]) : 10000;
+    auto gap = std::chrono::microseconds(argc > 2 ? std::stol(argv[2]) : 50);
+    if (roundTrips == 0)
+    {
+        std::cerr << "At least one round trip is needed!" << std::endl;
+        return 1;
+    }
+
+    // The device threads are pinned to the first two CPUs the process may run on, the driver is left unpinned.
+    auto cpus = FcmCpuTopology::detect().cpus;
+    int pingCpu = cpus.front().id;
+    int pongCpu = cpus.size() > 1 ? cpus[1].id : pingCpu;
+    if (cpus.size() < 3)
+    {
+        std::cout << "Only " << cpus.size() << " CPU(s) available, polling strategies compete with the driver.\n";
+    }
+
+    std::cout << std::left << std::setw(16) << "strategy" << std::setw(10) << "pinned"
+              << std::right << std::setw(12) << "mean [us]" << std::setw(12) << "p50 [us]"
+              << std::setw(12) << "p99 [us]" << std::setw(12) << "max [us]" << "\n";
+
+    for (auto waitStrategy : {FcmWaitStrategy::Block, FcmWaitStrategy::SpinThenBlock, FcmWaitStrategy::BusyPoll})
+    {
+        for (bool pinned : {false, true})
+        {
+            BenchmarkConfig pingConfig{waitStrategy, pinned ? std::optional<int>(pingCpu) : std::nullopt};
+            BenchmarkConfig pongConfig{waitStrategy, pinned ? std::optional<int>(pongCpu) : std::nullopt};
+            auto report = measure(pingConfig, pongConfig, roundTrips, gap);
+
+            std::cout << std::left << std::setw(16) << getStrategyName(waitStrategy)
+                      << std::setw(10) << (pinned ? "yes" : "no") << std::right << std::fixed << std::setprecision(1)
+                      << std::setw(12) << report.mean << std::setw(12) << report.p50
+                      << std::setw(12) << report.p99 << std::setw(12) << report.maxLatency << std::endl;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+// ---------------------------------------------------------------------------------------------------------------------
+// Load regression check: runs a fixed synthetic topology through FcmLoadHarness and compares the report with a
+// baseline saved by an earlier run. Exits with 1 when the throughput dropped or a latency percentile rose by more than
+// the tolerance, or when messages did not complete, so it can gate a build.
+//
+//     g++ -std=c++17 -O2 -Iinc src/*.cpp bench/FcmLoadHarness.cpp -pthread -o load_harness
+//     ./load_harness save baseline.txt
+//     ./load_harness check baseline.txt [tolerance]
+//
+// The tolerance is a fraction, 0.1 by default. Baselines are only comparable on the same machine and build.
+// ---------------------------------------------------------------------------------------------------------------------
+#include <string>
+#include <iostream>
+#include <stdexcept>
+
+#include "FcmLoadHarness.h"
+
+namespace
+{
+    // -----------------------------------------------------------------------------------------------------------------
+    FcmTopologySpec getSpec()
+    {
+        FcmTopologySpec spec;
+        spec.componentCount = 8;
+        spec.fanOut = 2;
+        spec.hopCount = 4;
+        spec.actionCost = {FcmActionCost::Distribution::Exponential, 5};
+        spec.timerInterval = 10;
+        spec.timerActionCost = {FcmActionCost::Distribution::Fixed, 20};
+        spec.sourceCount = 2;
+        spec.messageRate = 2000;
+        spec.warmupTime = 500;
+        spec.measureTime = 5000;
+        return spec;
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    int printUsage()
+    {
+        std::cerr << "Usage: load_harness save <baseline>\n"
+                  << "       load_harness check <baseline> [tolerance]" << std::endl;
+        return 2;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        return printUsage();
+    }
+    std::string command = argv[1];
+    std::string baselinePath = argv[2];
+
+    try
+    {
+        if (command == "save")
+        {
+            auto report = FcmLoadHarness::run(getSpec());
+            std::cout << report.toString();
+            FcmLoadHarness::saveReport(report, baselinePath);
+            return 0;
+        }
+
+        if (command != "check")
+        {
+            return printUsage();
+        }
+
+        // The baseline is read first, so a missing one fails before the run.
+        double tolerance = argc > 3 ? std::stod(argv[3]) : 0.1;
+        auto baseline = FcmLoadHarness::loadReport(baselinePath);
+        auto report = FcmLoadHarness::run(getSpec());
+        std::cout << report.toString();
+
+        auto violations = FcmLoadHarness::check(report, FcmLoadThresholds::fromBaseline(baseline, tolerance));
+        for (const auto& violation : violations)
+        {
+            std::cerr << "REGRESSION: " << violation << std::endl;
+        }
+        return violations.empty() ? 0 : 1;
+    }
+    catch (const std::exception& exception)
+    {
+        std::cerr << exception.what() << std::endl;
+        return 2;
+    }
+}
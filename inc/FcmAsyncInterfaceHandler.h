@@ -2,6 +2,7 @@
 #define FCM_ASYNC_INTERFACE_HANDLER_H
 
 #include "FcmBaseComponent.h"
+#include "FcmPort.h"
 
 // ---------------------------------------------------------------------------------------------------------------------
 class FcmAsyncInterfaceHandler: public FcmBaseComponent
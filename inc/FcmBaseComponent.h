@@ -3,15 +3,24 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include <any>
 #include <functional>
 #include <memory>
 #include <optional>
+#include <atomic>
+#include <cstdint>
+#include <stdexcept>
+#include <shared_mutex>
+#include <unordered_map>
 
 #include "FcmMessage.h"
 #include "FcmMessageQueue.h"
+#include "FcmDeviceContext.h"
+#include "FcmSettingsSchema.h"
 
-using FcmSettings = std::map<std::string, std::any>;
+template <class Interface>
+class FcmPort;
 
 // Optional log-function type
 using FcmLogFunction = std::optional<std::function<void(const std::string& message)>>;
@@ -43,8 +52,17 @@ public:
                              const FcmSettings& settingsParam = {});
 
     virtual void connectInterface(const std::string& interfaceName, FcmBaseComponent* remoteComponent);
+    void disconnectInterface(const std::string& interfaceName, FcmBaseComponent* remoteComponent);
+    void disconnectAll();
     void sendMessage(const std::shared_ptr<FcmMessage>& message, size_t index = 0);
 
+    // Ports are defined in FcmPort.h, to be obtained after the interfaces are connected.
+    template <class Interface>
+    FcmPort<Interface> getPort(size_t index = 0);
+
+    template <class Interface>
+    FcmPort<Interface> getPortTo(FcmBaseComponent* remoteComponent);
+
     // -----------------------------------------------------------------------------------------------------------------
     template <typename T>
     void setSetting(const std::string& settingName, T& stateVariable)
@@ -90,11 +108,59 @@ public:
 
     virtual FcmComponentType getType() const { return FcmComponentType::Base; }
 
+    // Set when the component is destroyed at runtime, messages still queued for it are then discarded.
+    [[nodiscard]] bool isDestroyed() const { return destroyed; }
+
 protected:
+    // Connections are changed by the device thread while the component may be sending from another thread, e.g. an
+    // asynchronous interface handler or a component of another device. The mutex guards the interfaces, connectedFrom
+    // and sentCounts; sending holds it shared until the message is queued, so a disconnected component no longer
+    // receives once the disconnect returns.
+    mutable std::shared_mutex connectionMutex;
     std::map<std::string, std::vector<FcmBaseComponent*>> interfaces;
-    FcmMessageQueue& messageQueue = FcmMessageQueue::getInstance();
+
+    // Components having this component connected on one of their interfaces.
+    std::vector<FcmBaseComponent*> connectedFrom;
+    FcmMessageQueue& messageQueue = FcmDeviceContext::getMessageQueue();
 
     [[nodiscard]] std::string getLogPrefix(const std::string& logLevel) const;
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // The settings that can be changed while the device runs, see FcmSettingsSchema. Thread-safe, for asynchronous
+    // interface handlers and workers; the snapshot stays valid as long as it is held. Functional components read
+    // single settings on the device thread with getSetting().
+    [[nodiscard]] std::shared_ptr<const FcmSettingsSnapshot> acquireSettings() const
+    {
+        if (settingsStore == nullptr)
+        {
+            throw std::runtime_error("Component \"" + name + "\" has no settings schema!");
+        }
+        return settingsStore->acquire();
+    }
+
+    void sendMessageTo(const std::shared_ptr<FcmMessage>& message, FcmBaseComponent* receiver, size_t index);
+
+private:
+    template <class Interface>
+    friend class FcmPort;
+    friend class FcmDevice;
+    friend class FcmPlacementPlanner;
+    friend class FcmFunctionalComponent;
+    bool destroyed = false;
+
+    // Generation of the slot of a spawned component, stamped on the messages sent to it.
+    std::atomic<uint64_t>* slotGeneration = nullptr;
+
+    void removeRemote(FcmBaseComponent* remoteComponent);
+    void removeConnectedFrom(FcmBaseComponent* remoteComponent);
+
+    // Messages sent per connected component, only counted when enabled by the device, see FcmPlacementPlanner. The
+    // counters are created when connecting, so sending does not change the map.
+    bool countTraffic = false;
+    std::unordered_map<const FcmBaseComponent*, std::atomic<uint64_t>> sentCounts;
+
+    // Set by the device when it has a settings schema.
+    FcmSettingsStore* settingsStore = nullptr;
 };
 
 #endif // FCM_BASE_COMPONENT_H
\ No newline at end of file
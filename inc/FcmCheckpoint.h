@@ -0,0 +1,162 @@
+#ifndef FCM_CHECKPOINT_H
+#define FCM_CHECKPOINT_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+
+#include "FcmMessage.h"
+#include "FcmMessageQueue.h"
+#include "FcmTimerHandler.h"
+
+class FcmBaseComponent;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Binary encoding of checkpoint values: trivially copyable values as their bytes, strings length-prefixed.
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmCheckpointWriter
+{
+public:
+    template <typename T>
+    void write(const T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values and strings can be saved");
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void write(const std::string& value)
+    {
+        write(static_cast<uint32_t>(value.size()));
+        buffer.append(value);
+    }
+
+    [[nodiscard]] const std::string& getBuffer() const { return buffer; }
+
+private:
+    std::string buffer;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmCheckpointReader
+{
+public:
+    FcmCheckpointReader(const char* dataParam, size_t sizeParam): data(dataParam), remaining(sizeParam) {}
+
+    template <typename T>
+    bool read(T& value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "Only trivially copyable values and strings can be restored");
+        if (remaining < sizeof(T))
+        {
+            return false;
+        }
+        std::memcpy(&value, data, sizeof(T));
+        data += sizeof(T);
+        remaining -= sizeof(T);
+        return true;
+    }
+
+    bool read(std::string& value)
+    {
+        uint32_t size;
+        if (!read(size) || remaining < size)
+        {
+            return false;
+        }
+        value.assign(data, size);
+        data += size;
+        remaining -= size;
+        return true;
+    }
+
+    [[nodiscard]] bool atEnd() const { return remaining == 0; }
+    [[nodiscard]] size_t getRemaining() const { return remaining; }
+
+private:
+    const char* data;
+    size_t remaining;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmStateVariable
+{
+    std::string name;
+    std::function<void(FcmCheckpointWriter&)> save;
+
+    // Decodes the value without assigning it, the returned function assigns it and does not throw. Empty when the
+    // value cannot be decoded.
+    std::function<std::function<void()>(FcmCheckpointReader&)> load;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmMessageSerializer
+{
+    std::function<void(const FcmMessage&, FcmCheckpointWriter&)> save;
+    std::function<std::shared_ptr<FcmMessage>(FcmCheckpointReader&)> load;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Saves and restores the state of the functional components of a device: current and history state, registered state
+// variables, deferred and queued messages and armed timeouts. Components are matched by name on restore. Messages can
+// only be saved when their type is registered with registerMessage(), listing the members to save.
+//
+// A restore is all or nothing: the checkpoint is decoded and checked against the components (e.g. that their states
+// still exist) before anything is changed, and throws when it does not fit.
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmCheckpoint
+{
+public:
+    static void save(const std::string& path,
+                     const std::vector<FcmBaseComponent*>& components,
+                     FcmMessageQueue& messageQueue,
+                     FcmTimerHandler& timerHandler);
+
+    static void restore(const std::string& path,
+                        const std::vector<FcmBaseComponent*>& components,
+                        FcmMessageQueue& messageQueue,
+                        FcmTimerHandler& timerHandler);
+
+    // -----------------------------------------------------------------------------------------------------------------
+    template <typename MessageType, typename... Fields>
+    static void registerMessage(Fields MessageType::*... fields)
+    {
+        FcmMessageSerializer serializer;
+        serializer.save = [fields...](const FcmMessage& msg, FcmCheckpointWriter& writer)
+        {
+            const auto& message = static_cast<const MessageType&>(msg);
+            (writer.write(message.*fields), ...);
+        };
+        serializer.load = [fields...](FcmCheckpointReader& reader) -> std::shared_ptr<FcmMessage>
+        {
+            auto message = std::make_shared<MessageType>();
+            if (!(reader.read((*message).*fields) && ...))
+            {
+                return nullptr;
+            }
+            return message;
+        };
+
+        std::lock_guard<std::mutex> lock(getSerializersMutex());
+        getSerializers()[std::string(MessageType::interfaceName) + ":" + MessageType::name] = serializer;
+    }
+
+private:
+    static std::map<std::string, FcmMessageSerializer>& getSerializers();
+    static std::mutex& getSerializersMutex();
+    static void registerBuiltinMessages();
+
+    static void saveMessage(FcmCheckpointWriter& writer,
+                            const FcmMessage& message,
+                            const std::map<const void*, std::string>& componentNames);
+    static std::shared_ptr<FcmMessage> loadMessage(const std::string& interfaceName,
+                                                   const std::string& messageName,
+                                                   const std::string& payload);
+};
+
+#endif //FCM_CHECKPOINT_H
@@ -0,0 +1,63 @@
+#ifndef FCM_COMPONENT_SLAB_H
+#define FCM_COMPONENT_SLAB_H
+
+#include <map>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Allocator for equally sized component slots. Memory is obtained in chunks of slots and freed slots are reused, so
+// spawning and destroying components at runtime does not go through the general purpose heap. A chunk whose slots
+// are all free is returned to the heap, except for one kept as a spare, so memory follows the live components rather
+// than their peak.
+//
+// Each slot has a generation, kept in a table apart from the chunks so that it outlives both the components in the
+// slot and the chunk itself. It is changed when a component is destroyed, so a message stamped with the earlier
+// generation can be recognized as stale without touching the slot's current occupant, see FcmMessage::isStale().
+// A new chunk takes over the generations of a released one.
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmComponentSlab
+{
+public:
+    FcmComponentSlab(size_t slotSizeParam, size_t slotAlignmentParam, size_t slotsPerChunkParam = 64);
+    FcmComponentSlab(const FcmComponentSlab&) = delete;
+    FcmComponentSlab& operator=(const FcmComponentSlab&) = delete;
+    ~FcmComponentSlab();
+
+    void* allocate();
+    void deallocate(void* slot);
+
+    // Of the slot holding the given component.
+    std::atomic<uint64_t>& getGeneration(void* slot) const;
+
+    [[nodiscard]] size_t getUsedSlots() const { return usedSlots; }
+    [[nodiscard]] size_t getChunkCount() const { return chunksByAddress.size(); }
+
+private:
+    // The generations stay when the memory is released, a chunk allocated later reuses the entry.
+    struct Chunk
+    {
+        std::byte* memory = nullptr;
+        std::unique_ptr<std::atomic<uint64_t>[]> generations;
+        size_t usedSlots = 0;
+    };
+
+    const size_t slotAlignment;
+    const size_t slotSize;
+    const size_t slotsPerChunk;
+
+    std::vector<Chunk> chunks;
+    std::vector<size_t> releasedChunks;
+    std::map<const std::byte*, size_t> chunksByAddress;
+    std::vector<void*> freeSlots;
+    size_t usedSlots = 0;
+    size_t spareChunk = SIZE_MAX;
+
+    size_t findChunk(const void* slot) const;
+    void releaseChunk(size_t chunkIndex);
+};
+
+#endif //FCM_COMPONENT_SLAB_H
@@ -0,0 +1,126 @@
+#ifndef FCM_DEAD_LETTER_QUEUE_H
+#define FCM_DEAD_LETTER_QUEUE_H
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <string_view>
+#include <unordered_map>
+
+#include "FcmMessage.h"
+
+class FcmBaseComponent;
+
+// ---------------------------------------------------------------------------------------------------------------------
+enum class FcmDeadLetterReason
+{
+    NoTransition,   // The receiver has no transition for the message in its state
+    Unconnected     // The sender sent the message on an interface that is not connected
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// For NoTransition the component is the receiver, for Unconnected it is the sender. The state is empty for a
+// component that is not functional. The sender and receiver of a kept message are cleared, as the components may be
+// released while it is kept; they are identified by the component name.
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmDeadLetter
+{
+    std::shared_ptr<FcmMessage> message;
+    std::string componentName;
+    std::string state;
+    FcmDeadLetterReason reason = FcmDeadLetterReason::NoTransition;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmDeadLetterCount
+{
+    std::string componentName;
+    std::string state;
+    std::string interfaceName;
+    std::string messageName;
+    FcmDeadLetterReason reason = FcmDeadLetterReason::NoTransition;
+    uint64_t count = 0;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Messages the device could not deliver or the receiver could not handle. The most recent ones are kept, older ones
+// are overwritten, and each (component, state, message, reason) is counted. Only a sample is to be logged: the first
+// occurrence and then every sampleInterval-th, so a peer flooding unexpected messages does not have the device
+// thread spend its time formatting errors. At most counterCapacity distinct ones are counted, the least recently seen
+// one is evicted beyond that, so spawned components with ever new names do not grow the counters; an evicted one
+// starts again at 1 (and is logged again) when it recurs.
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmDeadLetterQueue
+{
+public:
+    explicit FcmDeadLetterQueue(size_t capacity = 256, uint64_t sampleInterval = 1000, size_t counterCapacity = 1024);
+    FcmDeadLetterQueue(const FcmDeadLetterQueue&) = delete;
+    FcmDeadLetterQueue& operator=(const FcmDeadLetterQueue&) = delete;
+
+    // Not thread-safe, to be set before the device starts running.
+    void configure(size_t capacity, uint64_t sampleInterval, size_t counterCapacity = 1024);
+
+    // Returns whether this occurrence is to be logged. The count of the occurrence is returned through count. Clears
+    // the sender and receiver of the message.
+    bool record(const FcmBaseComponent* component,
+                const std::string& state,
+                const std::shared_ptr<FcmMessage>& message,
+                FcmDeadLetterReason reason,
+                uint64_t& count);
+
+    // Oldest first.
+    [[nodiscard]] std::vector<FcmDeadLetter> getDeadLetters() const;
+    // Most recently seen first.
+    [[nodiscard]] std::vector<FcmDeadLetterCount> getCounts() const;
+    [[nodiscard]] uint64_t getTotalCount() const;
+    void clear();
+
+private:
+    // By name, the address of a destroyed component may be reused by one spawned later. A key refers to the names of
+    // the occurrence being recorded while it is looked up, and to those of its count once inserted, so the names are
+    // only copied for the first occurrence.
+    struct CountKey
+    {
+        std::string_view componentName;
+        std::string_view state;
+        std::string_view interfaceName;
+        std::string_view messageName;
+        FcmDeadLetterReason reason;
+
+        bool operator==(const CountKey& other) const
+        {
+            return reason == other.reason && componentName == other.componentName && state == other.state &&
+                   interfaceName == other.interfaceName && messageName == other.messageName;
+        }
+    };
+
+    struct CountKeyHash
+    {
+        size_t operator()(const CountKey& key) const;
+    };
+
+    // The ring refers to the count for the names, they are only put together into dead letters when asked for. It
+    // shares the count, so the names outlive its eviction.
+    struct RecordedLetter
+    {
+        std::shared_ptr<FcmMessage> message;
+        std::shared_ptr<const FcmDeadLetterCount> count;
+    };
+
+    using CountList = std::list<std::shared_ptr<FcmDeadLetterCount>>;
+
+    mutable std::mutex mutex;
+    size_t capacity;
+    uint64_t sampleInterval;
+    size_t counterCapacity;
+    std::vector<RecordedLetter> deadLetters;
+    size_t nextIndex = 0;
+    uint64_t totalCount = 0;
+    CountList counts;  // Most recently seen first, the least recently seen one is evicted
+    std::unordered_map<CountKey, CountList::iterator, CountKeyHash> counters;
+};
+
+#endif //FCM_DEAD_LETTER_QUEUE_H
@@ -2,7 +2,12 @@
 #define FCM_DEVICE_H
 
 #include <map>
+#include <new>
+#include <mutex>
+#include <atomic>
 #include <optional>
+#include <type_traits>
+#include <unordered_map>
 
 #include <FcmBaseComponent.h>
 #include <FcmFunctionalComponent.h>
@@ -10,25 +15,167 @@
 #include <FcmMessage.h>
 #include <FcmTimerHandler.h>
 #include <FcmMessageQueue.h>
+#include <FcmComponentSlab.h>
+#include <FcmPort.h>
+#include <FcmCheckpoint.h>
+#include <FcmWatchdog.h>
+#include <FcmDeadLetterQueue.h>
+#include <FcmSettingsSchema.h>
+#include <FcmTracer.h>
+#include <FcmDeviceContext.h>
+
+// ---------------------------------------------------------------------------------------------------------------------
+FCM_SET_INTERFACE(Device,
+    FCM_DEFINE_MESSAGE( ComponentDestroyed );
+    FCM_DEFINE_MESSAGE( Stop );
+);
 
 // ---------------------------------------------------------------------------------------------------------------------
 class FcmDevice
 {
 public:
     explicit FcmDevice();
+    virtual ~FcmDevice();
     virtual void initialize() = 0;
     [[noreturn]] void run();
 
+    // Like run(), but returns when stop() is called from another thread or an action. Messages queued after the
+    // stop request stay queued. A stop() before the run makes it return right away.
+    void runUntilStopped();
+    void stop();
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Each device has its own message queue and timer handler, given to its components when they are created with
+    // createComponent() or spawnComponent(). Components of different devices can be connected with the raw pointer
+    // variant of connectInterface(); their messages to each other pass through a lock-free channel.
+    // -----------------------------------------------------------------------------------------------------------------
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Runtime component management, to be used on the device thread (i.e. from actions) once the device is running.
+    // A spawned component is connected with the raw pointer variant of connectInterface() and then initialized with
+    // initializeComponent(). The settings must outlive the component.
+    // -----------------------------------------------------------------------------------------------------------------
+    template <class ComponentType>
+    ComponentType* spawnComponent(const std::string& _name, const FcmSettings& _settings)
+    {
+        static_assert(std::is_base_of_v<FcmFunctionalComponent, ComponentType>,
+                      "Only functional components can be spawned");
+
+        auto& slab = getSlab(sizeof(ComponentType), alignof(ComponentType));
+        void* memory = slab.allocate();
+        ComponentType* component;
+        try
+        {
+            FcmDeviceContext context(messageQueue, timerHandler);
+            component = new (memory) ComponentType(_name, _settings);
+        }
+        catch (...)
+        {
+            slab.deallocate(memory);
+            throw;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(componentsMutex);
+            spawnedComponents.emplace(component, SpawnedComponent{&slab, memory});
+        }
+        component->slotGeneration = &slab.getGeneration(memory);
+        component->watchdog = watchdog.get();
+        component->deadLetterQueue = &deadLetterQueue;
+        component->countTraffic = trafficCounting;
+        component->settingsStore = settingsStore.get();
+        return component;
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    template <class Interface>
+    static FcmConnection<Interface> connectInterface(FcmBaseComponent* firstComponent,
+                                                     FcmBaseComponent* secondComponent)
+    {
+        connectInterfaces(Interface::interfaceClassName, firstComponent, secondComponent);
+        return FcmConnection<Interface>{firstComponent->getPortTo<Interface>(secondComponent),
+                                        secondComponent->getPortTo<Interface>(firstComponent)};
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    template <class Interface>
+    static void disconnectInterface(FcmBaseComponent* firstComponent, FcmBaseComponent* secondComponent)
+    {
+        firstComponent->disconnectInterface(Interface::interfaceClassName, secondComponent);
+        secondComponent->disconnectInterface(Interface::interfaceClassName, firstComponent);
+    }
+
+    static void initializeComponent(FcmBaseComponent* component);
+    void destroyComponent(FcmBaseComponent* component);
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Checkpoints, see FcmCheckpoint. To be saved on the device thread and restored after initializeComponents().
+    // -----------------------------------------------------------------------------------------------------------------
+    void saveCheckpoint(const std::string& path);
+    void restoreCheckpoint(const std::string& path);
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Scheduling per component, see FcmSchedulingMode. The quota is the number of messages per turn (RoundRobin) or the
+    // relative share of processing time (WeightedFair) of the component, 1 by default.
+    // -----------------------------------------------------------------------------------------------------------------
+    void setComponentQuota(const FcmBaseComponent* component, unsigned int quota);
+    [[nodiscard]] std::map<std::string, FcmReceiverStatistics> getSchedulingStatistics() const;
+
+    // Empty when there is no watchdog.
+    [[nodiscard]] std::vector<FcmSlowTransition> getSlowestTransitions() const;
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Settings changed while the device runs, see FcmSettingsSchema. The update is thread-safe and all or nothing;
+    // the components see it from the next message on.
+    // -----------------------------------------------------------------------------------------------------------------
+    void updateSettings(const FcmSettings& changes);
+    [[nodiscard]] std::shared_ptr<const FcmSettingsSnapshot> acquireSettings() const;
+
+    // Messages the components could not handle or send, see FcmDeadLetterQueue.
+    [[nodiscard]] const FcmDeadLetterQueue& getDeadLetterQueue() const { return deadLetterQueue; }
+
+    // Counting of the messages the components send to each other, for FcmPlacementPlanner. Off by default, to be
+    // switched on before the device runs. The counts can be reset at any time, e.g. to plan on a recent window.
+    void setTrafficCounting(bool enabled);
+    void resetTrafficCounts();
+
 protected:
     FcmSettings settings{};
     std::vector<std::shared_ptr<FcmBaseComponent>> components;
 
+    // Latency tuning, to be set in initialize().
+    void setWaitStrategy(FcmWaitStrategy strategy, unsigned int spins = 10000, unsigned int yields = 100);
+    void setCpuAffinity(int cpu) { cpuAffinity = cpu; }
+
+    // Scheduling, to be set in initialize().
+    void setSchedulingMode(FcmSchedulingMode mode, int64_t quantum = 100);
+    void setComponentQuota(const std::shared_ptr<FcmBaseComponent>& component, unsigned int quota)
+    {
+        setComponentQuota(component.get(), quota);
+    }
+
+    // To be set in initialize() before creating the components, the initial values are taken from the settings.
+    void setSettingsSchema(const FcmSettingsSchema& schema);
+
+    // Number of dead letters kept, how often a recurring one is logged and how many distinct ones are counted, to be
+    // set in initialize().
+    void configureDeadLetters(size_t capacity, uint64_t sampleInterval, size_t counterCapacity = 1024);
+
+    // Watchdog on actions and choice-point evaluations taking longer than the budget (in microseconds), see
+    // FcmWatchdog for the signal used to capture a stack sample. To be set in initialize().
+    void setWatchdog(int64_t budget,
+                     const FcmWatchdogReportFunction& reportFunction,
+                     size_t topCount = 10,
+                     bool captureStack = false,
+                     int sampleSignal = 0);
+
     // -----------------------------------------------------------------------------------------------------------------
+    // Returns the ports of both components, which are unconnected on the side of an asynchronous interface handler.
     template <class Interface>
-    static void connectInterface(std::shared_ptr<FcmBaseComponent> firstComponent,
-                                 std::shared_ptr<FcmBaseComponent> secondComponent)
+    static FcmConnection<Interface> connectInterface(std::shared_ptr<FcmBaseComponent> firstComponent,
+                                                     std::shared_ptr<FcmBaseComponent> secondComponent)
     {
-        connectInterfaces(Interface::interfaceClassName, firstComponent.get(), secondComponent.get());
+        return connectInterface<Interface>(firstComponent.get(), secondComponent.get());
     }
 
     // -----------------------------------------------------------------------------------------------------------------
@@ -42,14 +189,55 @@ protected:
     std::shared_ptr<ComponentType> createComponent(const std::string& _name,
                                                    const FcmSettings& _settings)
     {
+        FcmDeviceContext context(messageQueue, timerHandler);
         auto component = std::make_shared<ComponentType>(_name, _settings);
+        component->countTraffic = trafficCounting;
+        component->settingsStore = settingsStore.get();
+        if constexpr (std::is_base_of_v<FcmFunctionalComponent, ComponentType>)
+        {
+            component->deadLetterQueue = &deadLetterQueue;
+        }
         components.push_back(component);
         return component;
     }
 
 private:
-    FcmMessageQueue& messageQueue;
+    friend class FcmPlacementPlanner;
+
+    struct SpawnedComponent
+    {
+        FcmComponentSlab* slab;
+        void* memory;
+    };
+
+    // Destroyed after the components, which refer to them.
+    FcmMessageQueue messageQueue;
+    FcmTimerHandler timerHandler;
+    FcmDeadLetterQueue deadLetterQueue;
+    std::unique_ptr<FcmSettingsStore> settingsStore;
+
+    std::optional<int> cpuAffinity;
+    std::unique_ptr<FcmWatchdog> watchdog;
+    std::atomic<bool> stopRequested{false};
+    bool trafficCounting = false;
+
+    std::map<std::pair<size_t, size_t>, std::unique_ptr<FcmComponentSlab>> slabs;
+
+    // Guards the spawned components and their destroyed flags against FcmPlacementPlanner and resetTrafficCounts()
+    // on other threads; a component is not released while it is held.
+    mutable std::mutex componentsMutex;
+    std::unordered_map<FcmBaseComponent*, SpawnedComponent> spawnedComponents;
+
+    FcmComponentSlab& getSlab(size_t size, size_t alignment);
+    void releaseComponent(FcmBaseComponent* component);
+
+    [[nodiscard]] std::vector<FcmBaseComponent*> getAllComponents() const;
+    [[nodiscard]] std::vector<FcmBaseComponent*> collectComponents() const;  // With the components mutex held
+    void prepareRun();
+    void applyCpuAffinity() const;
     void processMessages(std::shared_ptr<FcmMessage>& message);
+    void passQuiescentState();
+    static bool isStopMarker(const FcmMessage& message);
 };
 
 #endif //FCM_DEVICE_H
\ No newline at end of file
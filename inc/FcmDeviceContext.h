@@ -0,0 +1,28 @@
+#ifndef FCM_DEVICE_CONTEXT_H
+#define FCM_DEVICE_CONTEXT_H
+
+class FcmMessageQueue;
+class FcmTimerHandler;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Message queue and timer handler for the components constructed on this thread while the context exists. A device
+// sets its own while creating components. Components constructed outside a device context use the process-wide
+// queue and timer handler.
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmDeviceContext
+{
+public:
+    FcmDeviceContext(FcmMessageQueue& messageQueue, FcmTimerHandler& timerHandler);
+    FcmDeviceContext(const FcmDeviceContext&) = delete;
+    FcmDeviceContext& operator=(const FcmDeviceContext&) = delete;
+    ~FcmDeviceContext();
+
+    static FcmMessageQueue& getMessageQueue();
+    static FcmTimerHandler& getTimerHandler();
+
+private:
+    FcmMessageQueue* previousMessageQueue;
+    FcmTimerHandler* previousTimerHandler;
+};
+
+#endif //FCM_DEVICE_CONTEXT_H
@@ -8,12 +8,18 @@
 #include <map>
 #include <queue>
 #include <any>
+#include <type_traits>
 
 #include "FcmBaseComponent.h"
+#include "FcmPort.h"
 #include "FcmMessage.h"
+#include "FcmMessageSpan.h"
 #include "FcmStateTransitionTable.h"
 #include "FcmTimerHandler.h"
 #include "FcmMessageQueue.h"
+#include "FcmCheckpoint.h"
+#include "FcmWatchdog.h"
+#include "FcmDeadLetterQueue.h"
 
 // ---------------------------------------------------------------------------------------------------------------------
 class FcmFunctionalComponent: public FcmBaseComponent
@@ -32,12 +38,25 @@ public:
     template<typename MessageType, typename Action>
     inline void addTransitionFunction(const std::string& state, const std::string& nextState, Action action)
     {
-        addTransition(state, MessageType::interfaceName, MessageType::name, nextState,
-        [action](const std::shared_ptr<FcmMessage>& msg)
+        // A lambda without captures does not depend on the instance, so it is added as a bound transition.
+        if constexpr (std::is_convertible_v<Action, void (*)(const MessageType&)>)
         {
-            const auto& message = static_cast<const MessageType&>(*msg);
-            action(message);
-        });
+            addBoundTransition(state, MessageType::interfaceName, MessageType::name, nextState,
+            [action](FcmFunctionalComponent&, const std::shared_ptr<FcmMessage>& msg)
+            {
+                const auto& message = static_cast<const MessageType&>(*msg);
+                action(message);
+            });
+        }
+        else
+        {
+            addTransition(state, MessageType::interfaceName, MessageType::name, nextState,
+            [action](const std::shared_ptr<FcmMessage>& msg)
+            {
+                const auto& message = static_cast<const MessageType&>(*msg);
+                action(message);
+            });
+        }
     }
 
     // -----------------------------------------------------------------------------------------------------------------
@@ -46,15 +65,76 @@ public:
     {
         for (const auto& state : multipleStates)
         {
-            addTransition(state, MessageType::interfaceName, MessageType::name, nextState,
-            [action](const std::shared_ptr<FcmMessage>& msg)
-            {
-                const auto& message = static_cast<const MessageType&>(*msg);
-                action(message);
-            });
+            addTransitionFunction<MessageType>(state, nextState, action);
         }
     }
 
+    // -----------------------------------------------------------------------------------------------------------------
+    // Transition to a member function, bound to the instance at dispatch time. Unlike a lambda capturing 'this',
+    // it can be part of a shared table.
+    template<typename MessageType, typename Component>
+    inline void addTransitionMethod(const std::string& state, const std::string& nextState,
+                                    void (Component::*method)(const MessageType&))
+    {
+        addBoundTransition(state, MessageType::interfaceName, MessageType::name, nextState,
+        [method](FcmFunctionalComponent& component, const std::shared_ptr<FcmMessage>& msg)
+        {
+            const auto& message = static_cast<const MessageType&>(*msg);
+            (static_cast<Component&>(component).*method)(message);
+        });
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Transition taking a run of queued messages of the same type for this component at once, e.g. the samples of a
+    // sensor interface, as an FcmMessageSpan<MessageType> of up to maxBatchSize messages. A run is only taken when
+    // the transition returns to the same state and that state is not a choice-point. Otherwise each message is
+    // handled on its own, as a span of one, so the next message sees the new state.
+    template<typename MessageType, typename Action>
+    inline void addBatchTransition(const std::string& state, const std::string& nextState, Action action,
+                                   size_t maxBatchSize = 64)
+    {
+        constexpr bool bound = std::is_convertible_v<Action, void (*)(FcmMessageSpan<MessageType>)> ||
+                               std::is_convertible_v<Action, void (*)(const FcmMessageSpan<MessageType>&)>;
+        addBatchTransition(state, MessageType::interfaceName, MessageType::name, nextState,
+        [action](FcmFunctionalComponent&, const std::shared_ptr<FcmMessage>* messages, size_t count)
+        {
+            action(FcmMessageSpan<MessageType>(messages, count));
+        }, maxBatchSize, bound);
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    template<typename MessageType, typename Component>
+    inline void addBatchTransitionMethod(const std::string& state, const std::string& nextState,
+                                         void (Component::*method)(FcmMessageSpan<MessageType>),
+                                         size_t maxBatchSize = 64)
+    {
+        addBatchTransition(state, MessageType::interfaceName, MessageType::name, nextState,
+        [method](FcmFunctionalComponent& component, const std::shared_ptr<FcmMessage>* messages, size_t count)
+        {
+            (static_cast<Component&>(component).*method)(FcmMessageSpan<MessageType>(messages, count));
+        }, maxBatchSize, true);
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    template<typename Component>
+    inline void addChoicePointMethod(const std::string& choicePointName, bool (Component::*method)())
+    {
+        addBoundChoicePoint(choicePointName,
+        [method](FcmFunctionalComponent& component)
+        {
+            return (static_cast<Component&>(component).*method)();
+        });
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Defers the message in the given state: it is held by the component and queued again, in the order received,
+    // as soon as the component has changed state.
+    template<typename MessageType>
+    inline void addDeferral(const std::string& state)
+    {
+        addDeferral(state, MessageType::interfaceName, MessageType::name);
+    }
+
     // -----------------------------------------------------------------------------------------------------------------
     template<typename MessageType>
     inline std::shared_ptr<MessageType> castLastReceivedMessage()
@@ -72,7 +152,7 @@ public:
     FcmComponentType getType() const override { return FcmComponentType::Functional; }
 
 protected:
-    FcmTimerHandler& timerHandler = FcmTimerHandler::getInstance();
+    FcmTimerHandler& timerHandler = FcmDeviceContext::getTimerHandler();
     FcmStateTransitionTable stateTransitionTable;
     FcmChoicePointTable choicePointTable;
     std::shared_ptr<FcmMessage> lastReceivedMessage;
@@ -83,27 +163,137 @@ protected:
     virtual void setChoicePoints() = 0;
     virtual void setStates() = 0;
 
+    // Override to return true when all transitions and choice-points are bound, so the tables are only built by the
+    // first instance and shared by all instances of the class. The tables must then not depend on the settings.
+    [[nodiscard]] virtual bool sharesTables() const { return false; }
+
     void addTransition(const std::string& stateName,
                        const std::string& interfaceName,
                        const std::string& messageName,
                        const std::string& nextState,
                        const FcmSttAction& action);
 
+    void addBoundTransition(const std::string& stateName,
+                            const std::string& interfaceName,
+                            const std::string& messageName,
+                            const std::string& nextState,
+                            const FcmSttBoundAction& action);
+
+    void addDeferral(const std::string& stateName,
+                     const std::string& interfaceName,
+                     const std::string& messageName);
+
+    void addBatchTransition(const std::string& stateName,
+                            const std::string& interfaceName,
+                            const std::string& messageName,
+                            const std::string& nextState,
+                            const FcmSttBatchAction& action,
+                            size_t maxBatchSize,
+                            bool bound);
+
     void addChoicePoint( const std::string& choicePointName,
                          const FcmSttEvaluation& evaluationFunction);
 
+    void addBoundChoicePoint(const std::string& choicePointName,
+                             const FcmSttBoundEvaluation& evaluationFunction);
+
     bool performTransition(const std::shared_ptr<FcmMessage>& message);
+    void performTransitions(const std::shared_ptr<FcmMessage>& message);
+    bool performBatchTransition(const std::shared_ptr<FcmMessage>& message);
+    void evaluateChoicePoints();
+    void reportUnhandledMessage(const std::shared_ptr<FcmMessage>& message);
 
-    [[nodiscard]] bool evaluateChoicePoint(const std::string& choicePointName) const;
+    [[nodiscard]] bool evaluateChoicePoint(const std::string& choicePointName);
     void resendLastReceivedMessage();
 
-    std::optional<FcmSttTransition> getTransition(const std::string& stateName,
-                                                  const std::string& interfaceName,
-                                                  const std::string& messageName,
-                                                        std::string* notFoundReason = nullptr) const;
+    const FcmSttTransition* getTransition(const std::string& stateName,
+                                          const std::string& interfaceName,
+                                          const std::string& messageName,
+                                                std::string* notFoundReason = nullptr) const;
 
     [[nodiscard]] int setTimeout(FcmTime timeout);
+    [[nodiscard]] int setTimeout(FcmTimeMicroseconds timeout);
+
+    // Sends a timeout message every period until cancelled, see FcmTimerHandler.
+    [[nodiscard]] int setInterval(FcmTime period);
+    [[nodiscard]] int setInterval(FcmTimeMicroseconds period);
+
+    // No timeout message of the timer is handled after the cancel, also not one that had already expired.
     void cancelTimeout(int timerId);
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Setting that can be changed while the device runs, see FcmSettingsSchema. Read without locking, so only in
+    // actions and choice-points on the device thread, and the reference is not to be kept beyond the message being
+    // handled. Other threads use acquireSettings().
+    template <typename T>
+    const T& getSetting(const FcmSettingKey<T>& key) const
+    {
+        if (settingsStore == nullptr)
+        {
+            throw std::runtime_error("Component \"" + name + "\" has no settings schema!");
+        }
+        return settingsStore->read().get(key);
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Registers a variable to be included in checkpoints, to be called from initialize(). Trivially copyable types
+    // and strings are supported.
+    template <typename T>
+    void registerStateVariable(const std::string& variableName, T& variable)
+    {
+        stateVariables.push_back(FcmStateVariable{variableName,
+            [&variable](FcmCheckpointWriter& writer) { writer.write(variable); },
+            [&variable](FcmCheckpointReader& reader) -> std::function<void()>
+            {
+                T value{};
+                if (!reader.read(value))
+                {
+                    return {};
+                }
+                return [&variable, value = std::move(value)]() mutable { variable = std::move(value); };
+            }});
+    }
+
+private:
+    friend class FcmCheckpoint;
+    friend class FcmDevice;
+    std::vector<FcmStateVariable> stateVariables;
+    std::vector<std::shared_ptr<FcmMessage>> deferredMessages;
+
+    std::shared_ptr<const FcmComponentTables> sharedTables;
+
+    // Set by the device when it has a watchdog.
+    FcmWatchdog* watchdog = nullptr;
+
+    // Set by the device, without one every unhandled message is logged.
+    FcmDeadLetterQueue* deadLetterQueue = nullptr;
+
+    // Whether the transition table has batch transitions, and the run of messages taken for one.
+    bool hasBatchTransitions = false;
+    std::vector<std::shared_ptr<FcmMessage>> batchMessages;
+
+    void insertTransition(const std::string& stateName,
+                          const std::string& interfaceName,
+                          const std::string& messageName,
+                          FcmSttTransition transition);
+    void insertChoicePoint(const std::string& choicePointName, FcmSttChoicePoint choicePoint);
+    void buildSharedTables();
+    void findBatchTransitions();
+
+    [[nodiscard]] const FcmStateTransitionTable& getStateTransitionTable() const
+    {
+        return sharedTables ? sharedTables->stateTransitionTable : stateTransitionTable;
+    }
+
+    [[nodiscard]] const FcmChoicePointTable& getChoicePointTable() const
+    {
+        return sharedTables ? sharedTables->choicePointTable : choicePointTable;
+    }
+
+    [[nodiscard]] const std::vector<std::string>& getStates() const
+    {
+        return sharedTables ? sharedTables->states : states;
+    }
 };
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -125,6 +315,10 @@ protected:
         __VA_ARGS__ \
     }
 
+// ---------------------------------------------------------------------------------------------------------------------
+#define FCM_SHARED_TABLES \
+    bool sharesTables() const override { return true; }
+
 #define NOP (void)this
 
 #endif //FCM_FUNCTIONAL_COMPONENT_H
\ No newline at end of file
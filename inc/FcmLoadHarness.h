@@ -0,0 +1,110 @@
+#ifndef FCM_LOAD_HARNESS_H
+#define FCM_LOAD_HARNESS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "FcmMessageQueue.h"
+#include "FcmTimerHandler.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Distribution of the time an action takes, in microseconds. The action busy-spins for the sampled time.
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmActionCost
+{
+    enum class Distribution
+    {
+        Fixed,        // Always the mean
+        Uniform,      // Between minimum and maximum
+        Exponential   // With the given mean
+    };
+
+    Distribution distribution = Distribution::Fixed;
+    double mean = 0;
+    double minimum = 0;
+    double maximum = 0;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Shape of a synthetic device. Each message from a source enters at a component and is forwarded along the
+// downstream connections of the components (taken in turn) until it has made the given number of hops. Each component
+// cycles through its states, one transition per message received.
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmTopologySpec
+{
+    size_t componentCount = 8;
+    size_t fanOut = 2;                   // Downstream connections per component
+    size_t statesPerComponent = 4;       // Transitions per component
+    size_t hopCount = 4;                 // Components handling each message
+    FcmActionCost actionCost;
+    FcmTime timerInterval = 0;           // Periodic timeout per component in ms, 0 for none
+    FcmActionCost timerActionCost;
+
+    size_t sourceCount = 1;              // Asynchronous interface handlers sending messages
+    double messageRate = 1000;           // Messages per second per source, Poisson arrivals
+    FcmTime warmupTime = 500;            // ms, not measured
+    FcmTime measureTime = 5000;          // ms
+    FcmTime drainTimeout = 5000;         // ms, to wait for messages still in flight
+
+    FcmSchedulingMode schedulingMode = FcmSchedulingMode::Fifo;
+    FcmWaitStrategy waitStrategy = FcmWaitStrategy::Block;
+    unsigned int seed = 1;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Latencies are in microseconds, measured from the moment the message was due to be sent, so a device falling behind
+// shows as latency rather than as a lower sending rate.
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmLoadReport
+{
+    uint64_t sentCount = 0;              // Sent in the measurement window
+    uint64_t completedCount = 0;         // Of those, the ones that made all hops
+    double offeredRate = 0;              // Messages per second
+    double throughput = 0;               // Messages per second that made all hops within the window
+    int64_t p50 = 0;
+    int64_t p99 = 0;
+    int64_t p999 = 0;
+    int64_t maxLatency = 0;
+
+    [[nodiscard]] std::string toString() const;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Limits a report must stay within, 0 for no limit.
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmLoadThresholds
+{
+    double minThroughput = 0;
+    int64_t maxP50 = 0;
+    int64_t maxP99 = 0;
+    int64_t maxP999 = 0;
+    bool allowIncomplete = false;
+
+    // Allows the throughput to be the tolerance fraction lower and the latencies to be that fraction higher.
+    static FcmLoadThresholds fromBaseline(const FcmLoadReport& baseline, double tolerance);
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Builds a device from a topology spec, drives it with open-loop load and measures the end-to-end latency. Meant for
+// a small program that fails when check() reports violations, e.g. against a baseline saved by an earlier run, as
+// bench/FcmLoadHarness.cpp does:
+//
+//     auto report = FcmLoadHarness::run(spec);
+//     auto baseline = FcmLoadHarness::loadReport("baseline.txt");
+//     auto violations = FcmLoadHarness::check(report, FcmLoadThresholds::fromBaseline(baseline, 0.1));
+//     return violations.empty() ? 0 : 1;
+//
+// The device runs on a thread of the harness, with its own message queue and timer handler.
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmLoadHarness
+{
+public:
+    static FcmLoadReport run(const FcmTopologySpec& spec);
+    static std::vector<std::string> check(const FcmLoadReport& report, const FcmLoadThresholds& thresholds);
+
+    static void saveReport(const FcmLoadReport& report, const std::string& path);
+    static FcmLoadReport loadReport(const std::string& path);
+};
+
+#endif //FCM_LOAD_HARNESS_H
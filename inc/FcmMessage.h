@@ -1,6 +1,7 @@
 #ifndef FCM_MESSAGE_H
 #define FCM_MESSAGE_H
 
+#include <atomic>
 #include <string>
 #include <cstdint>
 
@@ -18,9 +19,21 @@ public:
     void* receiver = nullptr;
     void* sender = nullptr;
     int   interfaceIndex = 0;
-    int64_t timestamp{};
-    std::string getInterfaceName() const { return interfaceName; }
-    std::string getName() const { return name; }
+    int64_t timestamp{};   // Steady clock time when queued, in microseconds
+    uint64_t traceId = 0;  // Set when queued while tracing, see FcmTracer
+
+    // Set when sent to a spawned component: the generation of its slot at sending, see FcmComponentSlab.
+    const std::atomic<uint64_t>* receiverGeneration = nullptr;
+    uint64_t sentGeneration = 0;
+
+    // The receiver was destroyed after the message was sent, its slot may already hold another component.
+    [[nodiscard]] bool isStale() const
+    {
+        return receiverGeneration != nullptr && receiverGeneration->load(std::memory_order_acquire) != sentGeneration;
+    }
+
+    const std::string& getInterfaceName() const { return interfaceName; }
+    const std::string& getName() const { return name; }
     void setInterfaceName(const std::string& newInterfaceName) { interfaceName = newInterfaceName; }
     void setName(const std::string& newName) { name = newName; }
 
@@ -0,0 +1,42 @@
+#ifndef FCM_MESSAGE_CHANNEL_H
+#define FCM_MESSAGE_CHANNEL_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+#include "FcmMessage.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Bounded lock-free channel carrying messages between devices: any thread can push, one thread at a time may pop.
+// Each slot carries a sequence number telling whether it is free or filled for the current lap (D. Vyukov's bounded
+// queue).
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmMessageChannel
+{
+public:
+    explicit FcmMessageChannel(size_t capacity = 1024);
+    FcmMessageChannel(const FcmMessageChannel&) = delete;
+    FcmMessageChannel& operator=(const FcmMessageChannel&) = delete;
+
+    // Returns false when the channel is full.
+    bool push(const std::shared_ptr<FcmMessage>& message);
+    bool pop(std::shared_ptr<FcmMessage>& message);
+    [[nodiscard]] bool empty() const;
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> sequence;
+        std::shared_ptr<FcmMessage> message;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+
+    // On separate cache lines, the senders only contend on the first.
+    alignas(64) std::atomic<size_t> pushPosition{0};
+    alignas(64) std::atomic<size_t> popPosition{0};
+};
+
+#endif //FCM_MESSAGE_CHANNEL_H
@@ -2,23 +2,114 @@
 #define FCM_MESSAGE_QUEUE_H
 
 #include <list>
+#include <deque>
 #include <mutex>
+#include <chrono>
+#include <vector>
+#include <atomic>
 #include <memory>
+#include <cstdint>
 #include <optional>
 #include <functional>
+#include <unordered_map>
 #include <condition_variable>
 
 #include <FcmMessage.h>
+#include <FcmMessageChannel.h>
 
 using FcmMessageCheckFunction = std::function<bool(const std::shared_ptr<FcmMessage>&)>;
 
+// ---------------------------------------------------------------------------------------------------------------------
+// How the device thread waits for the next message.
+//   Block         : sleep on the condition variable.
+//   SpinThenBlock : poll for a while, then yield for a while, then sleep.
+//   BusyPoll      : poll without ever sleeping, occupying a core.
+// ---------------------------------------------------------------------------------------------------------------------
+enum class FcmWaitStrategy
+{
+    Block,
+    SpinThenBlock,
+    BusyPoll
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Order in which messages are handed to the device thread.
+//   Fifo         : in arrival order, regardless of the receiver.
+//   RoundRobin   : receivers with queued messages take turns, each handling up to its quota of messages per turn.
+//   WeightedFair : receivers take turns sharing the processing time of the device thread in proportion to their
+//                  quota, so a receiver with expensive transitions cannot starve the others.
+// The messages of one receiver are always handled in arrival order.
+// ---------------------------------------------------------------------------------------------------------------------
+enum class FcmSchedulingMode
+{
+    Fifo,
+    RoundRobin,
+    WeightedFair
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Time messages waited in the queue for one receiver, in microseconds. Only kept when scheduling per receiver.
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmReceiverStatistics
+{
+    uint64_t messageCount = 0;
+    uint64_t totalWaitTime = 0;
+    uint64_t maxWaitTime = 0;
+};
+
 // ---------------------------------------------------------------------------------------------------------------------
 class FcmMessageQueue
 {
 private:
+    using Clock = std::chrono::steady_clock;
+    using QueueIterator = std::list<std::shared_ptr<FcmMessage>>::iterator;
+
+    struct LaneEntry
+    {
+        QueueIterator message;
+        Clock::time_point enqueueTime;
+    };
+
+    // The queued messages of one receiver, referring into the queue.
+    struct Lane
+    {
+        std::deque<LaneEntry> entries;
+        unsigned int quota = 1;
+        unsigned int handledInTurn = 0;
+        int64_t deficit = 0;  // Nanoseconds
+        bool turnStarted = false;
+        bool active = false;
+        FcmReceiverStatistics statistics;
+    };
+
     std::list<std::shared_ptr<FcmMessage>> queue;
-    std::mutex mutex;
+    mutable std::mutex mutex;
     std::condition_variable conditionVariable;
+    std::atomic<size_t> pendingCount{0};
+    std::atomic<int> sleepingWaiters{0};
+    FcmMessageChannel remoteChannel;
+
+    FcmWaitStrategy waitStrategy = FcmWaitStrategy::Block;
+    unsigned int spinCount = 0;
+    unsigned int yieldCount = 0;
+
+    FcmSchedulingMode schedulingMode = FcmSchedulingMode::Fifo;
+    int64_t weightedFairQuantum = 100000;  // Nanoseconds
+    std::unordered_map<const void*, Lane> lanes;
+    std::deque<Lane*> activeLanes;
+    Lane* servedLane = nullptr;
+    Clock::time_point serveTime;
+
+    void pushLocked(const std::shared_ptr<FcmMessage>& message);
+    void pushToChannel(const std::shared_ptr<FcmMessage>& message);
+    void enqueue(const std::shared_ptr<FcmMessage>& message);
+    void drainRemoteChannel();
+    void spinForMessage() const;
+    void addToLane(QueueIterator message, bool atFront);
+    void removeFromLane(QueueIterator message);
+    void rebuildLanes();
+    void chargeServedLane();
+    QueueIterator takeScheduledMessage();
 
 public:
     FcmMessageQueue() = default;
@@ -32,11 +123,33 @@ public:
     }
     
     void push(const std::shared_ptr<FcmMessage>& message);
+
+    // For messages from the components of another device, without taking the lock unless the device thread sleeps.
+    void pushRemote(const std::shared_ptr<FcmMessage>& message);
     std::shared_ptr<FcmMessage> awaitMessage();
+
+    // For the device thread, after awaitMessage(): appends up to maxCount messages that directly follow the given
+    // message for the same receiver and are of the same type, taking them from the queue.
+    size_t takeRun(const FcmMessage& message, size_t maxCount, std::vector<std::shared_ptr<FcmMessage>>& run);
     bool removeMessage(const std::string& interfaceName,
                        const std::string& messageName,
                        const FcmMessageCheckFunction& checkFunction);
+    size_t removeMessages(const FcmMessageCheckFunction& checkFunction);
+    [[nodiscard]] std::vector<std::shared_ptr<FcmMessage>> getMessages();
     void resendMessage( const std::shared_ptr<FcmMessage>& message);
+    void resendMessages(const std::vector<std::shared_ptr<FcmMessage>>& messages);
+
+    // Not thread-safe, to be set before the device starts running.
+    void setWaitStrategy(FcmWaitStrategy strategy, unsigned int spins = 10000, unsigned int yields = 100);
+
+    // The quantum is the processing time in microseconds a receiver with quota 1 gets per turn in WeightedFair mode.
+    void setSchedulingMode(FcmSchedulingMode mode, int64_t quantum = 100);
+    void setReceiverQuota(const void* receiver, unsigned int quota);
+    [[nodiscard]] std::unordered_map<const void*, FcmReceiverStatistics> getReceiverStatistics() const;
+
+    // For a receiver that is released, whose address may be reused: its lane with the quota and statistics is
+    // dropped, as are the messages still in the lane.
+    void removeReceiver(const void* receiver);
 };
 
 #endif //FCM_MESSAGE_QUEUE_H
\ No newline at end of file
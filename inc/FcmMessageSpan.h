@@ -0,0 +1,79 @@
+#ifndef FCM_MESSAGE_SPAN_H
+#define FCM_MESSAGE_SPAN_H
+
+#include <memory>
+#include <cstddef>
+#include <iterator>
+
+#include "FcmMessage.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Read-only view of a run of messages of one type, as handed to a batch transition. The view is only valid during
+// the action. The message objects themselves are not contiguous, so samples meant for vectorized processing are to be
+// gathered from the messages first.
+// ---------------------------------------------------------------------------------------------------------------------
+template<typename MessageType>
+class FcmMessageSpan
+{
+public:
+    class Iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = MessageType;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const MessageType*;
+        using reference = const MessageType&;
+
+        explicit Iterator(const std::shared_ptr<FcmMessage>* positionParam) : position(positionParam) {}
+
+        reference operator*() const { return static_cast<reference>(**position); }
+        pointer operator->() const { return static_cast<pointer>(position->get()); }
+        reference operator[](difference_type offset) const { return static_cast<reference>(*position[offset]); }
+
+        Iterator& operator++() { ++position; return *this; }
+        Iterator operator++(int) { auto previous = *this; ++position; return previous; }
+        Iterator& operator--() { --position; return *this; }
+        Iterator operator--(int) { auto previous = *this; --position; return previous; }
+        Iterator& operator+=(difference_type offset) { position += offset; return *this; }
+        Iterator& operator-=(difference_type offset) { position -= offset; return *this; }
+        Iterator operator+(difference_type offset) const { return Iterator(position + offset); }
+        Iterator operator-(difference_type offset) const { return Iterator(position - offset); }
+        difference_type operator-(const Iterator& other) const { return position - other.position; }
+
+        bool operator==(const Iterator& other) const { return position == other.position; }
+        bool operator!=(const Iterator& other) const { return position != other.position; }
+        bool operator<(const Iterator& other) const { return position < other.position; }
+        bool operator>(const Iterator& other) const { return position > other.position; }
+        bool operator<=(const Iterator& other) const { return position <= other.position; }
+        bool operator>=(const Iterator& other) const { return position >= other.position; }
+
+    private:
+        const std::shared_ptr<FcmMessage>* position;
+    };
+
+    FcmMessageSpan(const std::shared_ptr<FcmMessage>* messagesParam, size_t countParam) :
+        messages(messagesParam), count(countParam) {}
+
+    [[nodiscard]] size_t size() const { return count; }
+    [[nodiscard]] bool empty() const { return count == 0; }
+
+    const MessageType& operator[](size_t index) const { return static_cast<const MessageType&>(*messages[index]); }
+    const MessageType& front() const { return (*this)[0]; }
+    const MessageType& back() const { return (*this)[count - 1]; }
+
+    // For keeping a message beyond the action.
+    [[nodiscard]] std::shared_ptr<const MessageType> share(size_t index) const
+    {
+        return std::static_pointer_cast<const MessageType>(messages[index]);
+    }
+
+    Iterator begin() const { return Iterator(messages); }
+    Iterator end() const { return Iterator(messages + count); }
+
+private:
+    const std::shared_ptr<FcmMessage>* messages;
+    size_t count;
+};
+
+#endif //FCM_MESSAGE_SPAN_H
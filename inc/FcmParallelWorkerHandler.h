@@ -0,0 +1,112 @@
+#ifndef FCM_PARALLEL_WORKER_H
+#define FCM_PARALLEL_WORKER_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <condition_variable>
+
+#include "FcmWorkerHandler.h"
+#include "FcmWorkerPool.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Worker for jobs that split into independent items. The items are divided into chunks which are processed in
+// parallel on the worker pool, after which the partial results are reduced in chunk order into 'result'.
+// ---------------------------------------------------------------------------------------------------------------------
+template <typename Result>
+class FcmParallelWorkerHandler: public FcmWorkerHandler
+{
+public:
+    using FcmWorkerHandler::FcmWorkerHandler;
+
+protected:
+    // Number of items per chunk, 0 selects a size giving a few chunks per pool thread.
+    size_t chunkSize = 0;
+
+    // Outcome of the reduction, to be used by prepareFinishedMessage().
+    Result result{};
+
+    // Methods to be overridden by subclass to split, process and combine the job
+    virtual size_t getItemCount() = 0;
+    virtual Result processChunk(size_t begin, size_t end) = 0;
+    virtual Result reduce(Result accumulated, Result partial) = 0;
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void run() override
+    {
+        result = Result{};
+
+        size_t itemCount = getItemCount();
+        if (itemCount == 0)
+        {
+            return;
+        }
+
+        auto& pool = FcmWorkerPool::getInstance();
+        size_t itemsPerChunk = chunkSize != 0 ? chunkSize : std::max<size_t>(1, itemCount / (pool.size() * 4));
+        size_t chunkCount = (itemCount + itemsPerChunk - 1) / itemsPerChunk;
+
+        // Shared with the helper jobs, which may only get to run after this job has finished.
+        auto chunks = std::make_shared<ChunkState>();
+        chunks->partials.resize(chunkCount);
+
+        auto processChunks = [this, chunks, itemsPerChunk, itemCount, chunkCount]()
+        {
+            size_t chunk;
+            while ((chunk = chunks->nextChunk.fetch_add(1)) < chunkCount)
+            {
+                if (!isCancelRequested())
+                {
+                    size_t begin = chunk * itemsPerChunk;
+                    size_t end = std::min(begin + itemsPerChunk, itemCount);
+                    chunks->partials[chunk] = processChunk(begin, end);
+                }
+
+                if (chunks->doneChunks.fetch_add(1) + 1 == chunkCount)
+                {
+                    std::lock_guard<std::mutex> lock(chunks->mutex);
+                    chunks->allDone.notify_all();
+                }
+            }
+        };
+
+        size_t helperCount = std::min(pool.size(), chunkCount) - 1;
+        for (size_t helper = 0; helper < helperCount; helper++)
+        {
+            pool.submit(processChunks);
+        }
+
+        // This job takes part as well, so it only waits for chunks already claimed by running helpers.
+        processChunks();
+        {
+            std::unique_lock<std::mutex> lock(chunks->mutex);
+            chunks->allDone.wait(lock, [&chunks, chunkCount]() { return chunks->doneChunks.load() == chunkCount; });
+        }
+
+        if (isCancelRequested())
+        {
+            return;
+        }
+
+        result = std::move(*chunks->partials[0]);
+        for (size_t chunk = 1; chunk < chunkCount; chunk++)
+        {
+            result = reduce(std::move(result), std::move(*chunks->partials[chunk]));
+        }
+    }
+
+private:
+    struct ChunkState
+    {
+        std::atomic<size_t> nextChunk{0};
+        std::atomic<size_t> doneChunks{0};
+        std::mutex mutex;
+        std::condition_variable allDone;
+        std::vector<std::optional<Result>> partials;
+    };
+};
+
+#endif //FCM_PARALLEL_WORKER_H
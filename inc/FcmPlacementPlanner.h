@@ -0,0 +1,81 @@
+#ifndef FCM_PLACEMENT_PLANNER_H
+#define FCM_PLACEMENT_PLANNER_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class FcmDevice;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// A logical CPU, with the CPU that identifies the group of CPUs sharing its L2 cache and its NUMA node.
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmCpu
+{
+    int id = 0;
+    int l2Group = 0;
+    int numaNode = 0;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmCpuTopology
+{
+    std::vector<FcmCpu> cpus;
+
+    // The CPUs the process may run on, read from /sys on Linux. Elsewhere, or when /sys cannot be read, the CPUs are
+    // taken to share nothing and to be on one NUMA node.
+    static FcmCpuTopology detect();
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// A device thread of the plan, with the CPU to pin it to and the components it is to run.
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmPlacementThread
+{
+    int cpu = 0;
+    int numaNode = 0;
+    uint64_t load = 0;  // Messages received by the components, plus one per component
+    std::vector<std::string> componentNames;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Traffic is the number of messages counted between functional components, in both directions.
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmPlacementPlan
+{
+    std::vector<FcmPlacementThread> threads;
+    std::map<std::string, size_t> threadOfComponent;
+
+    uint64_t totalTraffic = 0;
+    uint64_t currentCrossThreadTraffic = 0;  // Between components of different devices as they are now
+    uint64_t plannedCrossThreadTraffic = 0;
+    uint64_t plannedCrossL2Traffic = 0;
+    uint64_t plannedCrossNumaTraffic = 0;
+
+    [[nodiscard]] std::string toString() const;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Plans which components to run together on a device thread and where to pin those threads, from the connections
+// between the components and the traffic counted by the devices (see FcmDevice::setTrafficCounting()). Components
+// exchanging many messages are kept on one thread as far as the load allows, and threads exchanging many messages
+// are put on CPUs sharing an L2 cache or else a NUMA node.
+//
+// Components cannot move between running devices, so the plan is applied when the devices are next built: a device
+// creates the components of one plan thread and pins itself to its CPU. Planning again on recent counts (after
+// FcmDevice::resetTrafficCounts()) shows whether it is worth rebuilding. Asynchronous interface handlers run on their
+// own threads and are left out. Component names must be unique over the devices. The devices may be running while
+// planning, their components and counts are copied first.
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmPlacementPlanner
+{
+public:
+    // The imbalance is the fraction by which the load of a thread may exceed an even share.
+    static FcmPlacementPlan plan(const std::vector<FcmDevice*>& devices,
+                                 size_t threadCount,
+                                 const FcmCpuTopology& topology,
+                                 double imbalance = 0.25);
+};
+
+#endif //FCM_PLACEMENT_PLANNER_H
@@ -0,0 +1,186 @@
+#ifndef FCM_PORT_H
+#define FCM_PORT_H
+
+#include <memory>
+#include <optional>
+#include <algorithm>
+#include <shared_mutex>
+
+#include "FcmBaseComponent.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+constexpr bool fcmNamesEqual(const char* first, const char* second)
+{
+    while (*first != '\0' && *first == *second)
+    {
+        first++;
+        second++;
+    }
+    return *first == *second;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Handle for sending on an interface to one remote component, resolved when the port is obtained. Sending through a
+// port skips the interface lookup of sendMessage() and sending a message of another interface does not compile.
+// A port is invalidated when the remote component is disconnected from the interface or destroyed: sending then logs
+// an error, also when a component spawned later took its place. When an earlier connection of the interface is
+// removed, the port follows the remote component to its new index. A port must not be used once its owner is
+// destroyed.
+// ---------------------------------------------------------------------------------------------------------------------
+template <class Interface>
+class FcmPort
+{
+public:
+    FcmPort() = default;
+    explicit FcmPort(FcmBaseComponent* ownerParam): owner(ownerParam) {}
+
+    // To be constructed with the connection mutex of the owner held, the remotes are the list of the interface.
+    FcmPort(FcmBaseComponent* ownerParam, const std::vector<FcmBaseComponent*>* remotesParam, size_t indexParam):
+        owner(ownerParam),
+        remote((*remotesParam)[indexParam]),
+        remotes(remotesParam),
+        index(indexParam),
+        remoteGeneration(remote->slotGeneration),
+        generation(remoteGeneration != nullptr ? remoteGeneration->load(std::memory_order_relaxed) : 0)
+    {
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    template <typename MessageType>
+    void send(const std::shared_ptr<MessageType>& message) const
+    {
+        static_assert(fcmNamesEqual(MessageType::interfaceName, Interface::interfaceClassName),
+                      "Message does not belong to the interface of the port");
+
+        if (remote == nullptr)
+        {
+            if (owner != nullptr)
+            {
+                owner->logError("Trying to send message \"" + message->getName() +
+                                "\" through an unconnected port of interface \"" +
+                                Interface::interfaceClassName + "\"!");
+            }
+            return;
+        }
+
+        // Held while queueing, as in sendMessage(), so the remote cannot be released in between.
+        std::shared_lock<std::shared_mutex> lock(owner->connectionMutex);
+        auto currentIndex = findRemote();
+        if (!currentIndex.has_value())
+        {
+            lock.unlock();
+            owner->logError("Trying to send message \"" + message->getName() +
+                            "\" through a port of interface \"" + Interface::interfaceClassName +
+                            "\" that has been disconnected!");
+            return;
+        }
+
+        owner->sendMessageTo(message, remote, currentIndex.value());
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    [[nodiscard]] bool isConnected() const
+    {
+        if (remote == nullptr)
+        {
+            return false;
+        }
+        std::shared_lock<std::shared_mutex> lock(owner->connectionMutex);
+        return findRemote().has_value();
+    }
+
+    // The current index of the remote component, or the last known one when the port was invalidated.
+    [[nodiscard]] size_t getIndex() const
+    {
+        if (remote == nullptr)
+        {
+            return index;
+        }
+        std::shared_lock<std::shared_mutex> lock(owner->connectionMutex);
+        return findRemote().value_or(index);
+    }
+
+    [[nodiscard]] FcmBaseComponent* getRemote() const { return remote; }
+
+private:
+    FcmBaseComponent* owner = nullptr;
+    FcmBaseComponent* remote = nullptr;
+
+    // The list is a node of the interfaces map of the owner, which keeps its entries once connected.
+    const std::vector<FcmBaseComponent*>* remotes = nullptr;
+    size_t index = 0;
+
+    // For a spawned remote component, see FcmComponentSlab.
+    const std::atomic<uint64_t>* remoteGeneration = nullptr;
+    uint64_t generation = 0;
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // With the connection mutex of the owner held. The generation is checked first: the slot outlives the remote.
+    std::optional<size_t> findRemote() const
+    {
+        if (remoteGeneration != nullptr && remoteGeneration->load(std::memory_order_relaxed) != generation)
+        {
+            return std::nullopt;
+        }
+
+        if (index < remotes->size() && (*remotes)[index] == remote)
+        {
+            return index;
+        }
+
+        auto remoteIt = std::find(remotes->begin(), remotes->end(), remote);
+        if (remoteIt == remotes->end())
+        {
+            return std::nullopt;
+        }
+        return static_cast<size_t>(remoteIt - remotes->begin());
+    }
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+template <class Interface>
+struct FcmConnection
+{
+    FcmPort<Interface> first;   // From the first to the second component
+    FcmPort<Interface> second;  // From the second to the first component
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+template <class Interface>
+FcmPort<Interface> FcmBaseComponent::getPort(size_t index)
+{
+    std::shared_lock<std::shared_mutex> lock(connectionMutex);
+    auto interfaceIt = interfaces.find(Interface::interfaceClassName);
+    if (interfaceIt == interfaces.end() || index >= interfaceIt->second.size())
+    {
+        lock.unlock();
+        logError("Port on index " + std::to_string(index) + " of interface \"" +
+                 Interface::interfaceClassName + "\" is not connected!");
+        return FcmPort<Interface>(this);
+    }
+
+    return FcmPort<Interface>(this, &interfaceIt->second, index);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+template <class Interface>
+FcmPort<Interface> FcmBaseComponent::getPortTo(FcmBaseComponent* remoteComponent)
+{
+    std::shared_lock<std::shared_mutex> lock(connectionMutex);
+    auto interfaceIt = interfaces.find(Interface::interfaceClassName);
+    if (interfaceIt == interfaces.end())
+    {
+        return FcmPort<Interface>(this);
+    }
+
+    auto& componentList = interfaceIt->second;
+    auto componentIt = std::find(componentList.begin(), componentList.end(), remoteComponent);
+    if (componentIt == componentList.end())
+    {
+        return FcmPort<Interface>(this);
+    }
+
+    return FcmPort<Interface>(this, &componentList, static_cast<size_t>(componentIt - componentList.begin()));
+}
+
+#endif //FCM_PORT_H
@@ -0,0 +1,152 @@
+#ifndef FCM_SETTINGS_SCHEMA_H
+#define FCM_SETTINGS_SCHEMA_H
+
+#include <any>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <typeindex>
+#include <functional>
+
+using FcmSettings = std::map<std::string, std::any>;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Typed handle of a setting, resolved to its slot when the schema is defined. Only valid with the schema that
+// created it.
+// ---------------------------------------------------------------------------------------------------------------------
+template<typename T>
+class FcmSettingKey
+{
+public:
+    [[nodiscard]] size_t getSlot() const { return slot; }
+
+private:
+    friend class FcmSettingsSchema;
+    explicit FcmSettingKey(size_t slotParam) : slot(slotParam) {}
+    size_t slot;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Immutable values of all settings of a schema. Values that did not change are shared with the previous snapshot.
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmSettingsSnapshot
+{
+public:
+    template<typename T>
+    const T& get(const FcmSettingKey<T>& key) const
+    {
+        return *static_cast<const T*>(values[key.getSlot()].get());
+    }
+
+    // Starts at 1 and is incremented by each update.
+    [[nodiscard]] uint64_t getVersion() const { return version; }
+
+private:
+    friend class FcmSettingsSchema;
+    std::vector<std::shared_ptr<const void>> values;
+    uint64_t version = 1;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// The settings that can be changed at runtime, with their types and defaults. Defined once, before the device
+// creates its components:
+//
+//     FcmSettingsSchema schema;
+//     timeoutKey = schema.add<FcmTime>("timeout", 100);
+//     thresholdKey = schema.add<double>("threshold", 0.5);
+//     setSettingsSchema(schema);
+//
+// A value given in an update must have exactly the type of the key, as with setSetting().
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmSettingsSchema
+{
+public:
+    template<typename T>
+    FcmSettingKey<T> add(const std::string& name, T defaultValue)
+    {
+        addEntry(name, typeid(T), std::make_shared<const T>(std::move(defaultValue)),
+        [](const std::any& value) -> std::shared_ptr<const void>
+        {
+            return std::make_shared<const T>(std::any_cast<const T&>(value));
+        });
+        return FcmSettingKey<T>(entries.size() - 1);
+    }
+
+    // The defaults, overridden by the values given for keys in the schema. Other values are ignored, so the settings
+    // of the device can be passed as they are.
+    [[nodiscard]] std::shared_ptr<const FcmSettingsSnapshot> createSnapshot(const FcmSettings& values) const;
+
+    // The base snapshot with the given values changed, all keys must be in the schema.
+    [[nodiscard]] std::shared_ptr<const FcmSettingsSnapshot> updateSnapshot(const FcmSettingsSnapshot& base,
+                                                                          const FcmSettings& changes) const;
+
+private:
+    using ValueFunction = std::function<std::shared_ptr<const void>(const std::any&)>;
+
+    struct Entry
+    {
+        std::string name;
+        std::type_index type;
+        std::shared_ptr<const void> defaultValue;
+        ValueFunction makeValue;
+    };
+
+    std::vector<Entry> entries;
+    std::map<std::string, size_t> slots;
+
+    void addEntry(const std::string& name,
+                  std::type_index type,
+                  std::shared_ptr<const void> defaultValue,
+                  ValueFunction makeValue);
+    [[nodiscard]] std::shared_ptr<const void> makeValue(const Entry& entry, const std::any& value) const;
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// The current snapshot of a device. Updates replace the snapshot under a lock, the device thread moves on to the new
+// one at its next quiescent state: when it has finished the message it was handling, or has got the next message
+// after waiting for it. So the device thread reads without locking, all reads for one message see the same snapshot,
+// and the replaced snapshot can be released there since actions do not keep the reference beyond the message. A
+// device that is not running holds on to the replaced snapshots until it runs again.
+//
+// Other threads, or actions that keep a snapshot beyond the message, use acquire().
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmSettingsStore
+{
+public:
+    FcmSettingsStore(const FcmSettingsSchema& schemaParam, const FcmSettings& values);
+    FcmSettingsStore(const FcmSettingsStore&) = delete;
+    FcmSettingsStore& operator=(const FcmSettingsStore&) = delete;
+
+    // Only on the device thread.
+    [[nodiscard]] const FcmSettingsSnapshot& read() const { return *deviceSnapshot; }
+
+    [[nodiscard]] std::shared_ptr<const FcmSettingsSnapshot> acquire() const;
+
+    // From any thread. Throws without changing anything when a key is unknown or a value has the wrong type.
+    void update(const FcmSettings& changes);
+
+    // Called by the device thread between messages.
+    void quiescentState()
+    {
+        if (retiredPending.load(std::memory_order_acquire))
+        {
+            releaseRetired();
+        }
+    }
+
+private:
+    const FcmSettingsSchema schema;
+    mutable std::mutex mutex;
+    std::shared_ptr<const FcmSettingsSnapshot> currentOwner;
+    const FcmSettingsSnapshot* deviceSnapshot = nullptr;
+    std::vector<std::shared_ptr<const FcmSettingsSnapshot>> retired;
+    std::atomic<bool> retiredPending{false};
+
+    void releaseRetired();
+};
+
+#endif //FCM_SETTINGS_SCHEMA_H
@@ -1,18 +1,35 @@
 #ifndef FCM_STATE_TRANSITION_TABLE_H
 #define FCM_STATE_TRANSITION_TABLE_H
 
+#include <map>
+#include <memory>
+#include <vector>
+#include <functional>
+
 #include "FcmMessage.h"
 
+class FcmFunctionalComponent;
+
 // ---------------------------------------------------------------------------------------------------------------------
 // State Transition Table
 // ---------------------------------------------------------------------------------------------------------------------
 
 using FcmSttAction = std::function<void(const std::shared_ptr<FcmMessage>&)>;
 
+// Action bound to the receiving instance at dispatch time, so it can be shared by all instances of a component class.
+using FcmSttBoundAction = std::function<void(FcmFunctionalComponent&, const std::shared_ptr<FcmMessage>&)>;
+
+// Action handling a run of queued messages of the same type at once, bound like FcmSttBoundAction.
+using FcmSttBatchAction = std::function<void(FcmFunctionalComponent&, const std::shared_ptr<FcmMessage>*, size_t)>;
+
 struct FcmSttTransition
 {
     FcmSttAction action;
     std::string nextState;
+    FcmSttBoundAction boundAction;
+    bool deferred;  // The message is held until the state changes, instead of being handled.
+    FcmSttBatchAction batchAction;
+    size_t maxBatchSize;
 };
 
 using FcmSttMessages = std::map<std::string, FcmSttTransition>;
@@ -26,7 +43,28 @@ using FcmStateTransitionTable = std::map<std::string, FcmSttInterfaces>;
 // ---------------------------------------------------------------------------------------------------------------------
 
 using FcmSttEvaluation = std::function<bool()>;
-using FcmChoicePointTable = std::map<std::string, FcmSttEvaluation>;
+using FcmSttBoundEvaluation = std::function<bool(FcmFunctionalComponent&)>;
+
+struct FcmSttChoicePoint
+{
+    FcmSttEvaluation evaluation;
+    FcmSttBoundEvaluation boundEvaluation;
+};
+
+using FcmChoicePointTable = std::map<std::string, FcmSttChoicePoint>;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Component Tables
+// ---------------------------------------------------------------------------------------------------------------------
+
+// The state machine of a component class. Built once per class and shared read-only by all its instances when the
+// class only uses bound actions and evaluations.
+struct FcmComponentTables
+{
+    std::vector<std::string> states;
+    FcmStateTransitionTable stateTransitionTable;
+    FcmChoicePointTable choicePointTable;
+};
 
 #endif //FCM_STATE_TRANSITION_TABLE_H
 
@@ -0,0 +1,147 @@
+#ifndef FCM_STREAMING_WORKER_H
+#define FCM_STREAMING_WORKER_H
+
+#include <mutex>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "FcmWorkerHandler.h"
+#include "FcmTimerHandler.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Worker that streams partial results while run() is still busy. Items emitted by run() are batched into
+// partial-result messages, which are sent at most once per 'minBatchInterval'. When a batch is full before the
+// interval has passed, emit() blocks the job until it may be sent or the job is cancelled. Items of a batch that is
+// not full are sent by a flush thread once the interval has passed, also when run() emits nothing more for a while.
+// ---------------------------------------------------------------------------------------------------------------------
+template <typename Item>
+class FcmStreamingWorkerHandler: public FcmWorkerHandler
+{
+public:
+    using FcmWorkerHandler::FcmWorkerHandler;
+
+    ~FcmStreamingWorkerHandler() override
+    {
+        // The job stops the flush thread when it finishes, unless run() has thrown.
+        cancelAndWait();
+        stopFlushThread();
+    }
+
+protected:
+    // Maximum number of items per partial-result message.
+    size_t maxBatchSize = 64;
+
+    // Minimum time between two partial-result messages in milliseconds.
+    FcmTime minBatchInterval = 10;
+
+    // Method to be overridden by subclass to wrap a batch of items in a partial-result message
+    virtual std::shared_ptr<FcmMessage> preparePartialMessage(std::vector<Item>& items) = 0;
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void emit(Item item)
+    {
+        std::chrono::steady_clock::time_point nextAllowed;
+        bool full;
+        {
+            std::lock_guard<std::mutex> lock(streamMutex);
+            pendingItems.push_back(std::move(item));
+            nextAllowed = lastSent + std::chrono::milliseconds(minBatchInterval);
+            full = pendingItems.size() >= maxBatchSize;
+            if (!full && std::chrono::steady_clock::now() < nextAllowed)
+            {
+                // Left to the flush thread, in case no further item comes before the interval has passed.
+                if (!flushThread.joinable())
+                {
+                    flushThread = std::thread(&FcmStreamingWorkerHandler::runFlushThread, this);
+                }
+                flushCondition.notify_one();
+                return;
+            }
+        }
+
+        // A cancelled job does not wait, the batch is then dropped by sendPartialMessage().
+        if (full)
+        {
+            (void)waitUntilCancelled(nextAllowed);
+        }
+        flush();
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(streamMutex);
+        flushLocked();
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void runFinished() override
+    {
+        // The remaining items are sent before the finished message.
+        stopFlushThread();
+        flush();
+    }
+
+private:
+    std::vector<Item> pendingItems;
+    std::chrono::steady_clock::time_point lastSent{};
+
+    std::mutex streamMutex;
+    std::condition_variable flushCondition;
+    std::thread flushThread;
+    bool flushThreadStopping = false;
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void flushLocked()
+    {
+        if (pendingItems.empty())
+        {
+            return;
+        }
+
+        sendPartialMessage(preparePartialMessage(pendingItems));
+        pendingItems.clear();
+        lastSent = std::chrono::steady_clock::now();
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void runFlushThread()
+    {
+        std::unique_lock<std::mutex> lock(streamMutex);
+        while (!flushThreadStopping)
+        {
+            if (pendingItems.empty())
+            {
+                flushCondition.wait(lock);
+                continue;
+            }
+
+            auto deadline = lastSent + std::chrono::milliseconds(minBatchInterval);
+            if (flushCondition.wait_until(lock, deadline) == std::cv_status::timeout)
+            {
+                flushLocked();
+            }
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void stopFlushThread()
+    {
+        if (!flushThread.joinable())
+        {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(streamMutex);
+            flushThreadStopping = true;
+        }
+        flushCondition.notify_one();
+        flushThread.join();
+        flushThreadStopping = false;
+    }
+};
+
+#endif //FCM_STREAMING_WORKER_H
@@ -2,19 +2,39 @@
 #define FCM_TIMER_HANDLER_H
 
 #include <map>
+#include <mutex>
+#include <chrono>
 #include <thread>
+#include <queue>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <condition_variable>
 
 #include <FcmMessage.h>
 #include <FcmMessageQueue.h>
 
 // ---------------------------------------------------------------------------------------------------------------------
-using FcmTime = long long;
+using FcmTime = long long;  // Milliseconds
+using FcmTimeMicroseconds = std::chrono::microseconds;
 
 // ---------------------------------------------------------------------------------------------------------------------
 struct FcmTimerInfo
 {
     void* component;
-    bool cancelled;
+    FcmTimeMicroseconds period;  // Zero for a one-shot timeout
+    std::chrono::steady_clock::time_point expiry;
+    uint64_t generation;
+    bool fired = false;          // Whether a timeout message of it may still be queued
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmArmedTimeout
+{
+    int timerId;
+    void* component;
+    FcmTimeMicroseconds remaining;
+    FcmTimeMicroseconds period;
 };
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -22,12 +42,24 @@ FCM_SET_INTERFACE(Timer,
     FCM_DEFINE_MESSAGE( Timeout, int timerId{}; );
 );
 
+// ---------------------------------------------------------------------------------------------------------------------
+// Timeouts and intervals are kept in a heap ordered by expiry and served by a single thread per handler, started when
+// the first one is set. Periodic timers are scheduled from their previous expiry rather than from the moment the
+// timeout message is handled, so they do not drift. Expiries missed because the handler fell behind are skipped, so
+// a late interval sends one timeout message and then keeps to its original phase.
+//
+// Cancelled and re-armed timeouts leave their entries in the heap until they come up, unless they outnumber the armed
+// ones, then the heap is rebuilt. Cancelling also removes timeout messages that have expired but are still queued, so
+// none arrive after the cancel; the queue is only searched when the timeout has fired before.
 // ---------------------------------------------------------------------------------------------------------------------
 class FcmTimerHandler
 {
 public:
+    using Clock = std::chrono::steady_clock;
 
     FcmTimerHandler() : messageQueue(FcmMessageQueue::getInstance()) {}
+    explicit FcmTimerHandler(FcmMessageQueue& messageQueueParam) : messageQueue(messageQueueParam) {}
+    ~FcmTimerHandler();
     FcmTimerHandler(const FcmTimerHandler&) = delete;
     FcmTimerHandler& operator=(const FcmTimerHandler&) = delete;
 
@@ -38,17 +70,44 @@ public:
     }
 
     [[nodiscard]] int setTimeout(FcmTime timeout, void* component);
+    [[nodiscard]] int setTimeout(FcmTimeMicroseconds timeout, void* component);
+    [[nodiscard]] int setInterval(FcmTime period, void* component);
+    [[nodiscard]] int setInterval(FcmTimeMicroseconds period, void* component);
     void cancelTimeout(int timerId);
+    void cancelComponentTimeouts(void* component);
+
+    // Used for checkpoints: the armed timeouts, and re-arming a timeout under its original timer-id.
+    [[nodiscard]] std::vector<FcmArmedTimeout> getArmedTimeouts();
+    void restoreTimeout(int timerId, FcmTimeMicroseconds remaining, FcmTimeMicroseconds period, void* component);
+
+private:
+    struct ScheduledExpiry
+    {
+        Clock::time_point expiry;
+        int timerId;
+        uint64_t generation;
+
+        bool operator>(const ScheduledExpiry& other) const { return expiry > other.expiry; }
+    };
 
-private:  
     std::unordered_map<int, FcmTimerInfo> timeouts;
+    std::unordered_multimap<void*, int> componentTimeouts;
+    std::priority_queue<ScheduledExpiry, std::vector<ScheduledExpiry>, std::greater<>> expiries;
     std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::thread timerThread;
+    bool stopping = false;
     FcmMessageQueue& messageQueue;
     int nextTimerId{};
+    uint64_t nextGeneration{};
 
+    void armTimeout(int timerId, FcmTimeMicroseconds timeout, FcmTimeMicroseconds period, void* component);
+    void runTimerThread();
+    void expireTimeout(const ScheduledExpiry& scheduledExpiry, Clock::time_point now);
+    void eraseTimeout(int timerId, void* component);
+    void purgeExpiries();
     void sendTimeoutMessage(int timerId, void* component);
-    bool removeTimeoutMessage(int timerId);
+    size_t removeTimeoutMessages(int timerId);
 };
 
 #endif //FCM_TIMER_HANDLER_H
-
@@ -0,0 +1,82 @@
+#ifndef FCM_TRACER_H
+#define FCM_TRACER_H
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+#include "FcmMessage.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Writes the message flow as Chrome trace events (JSON array format), to be opened in chrome://tracing or Perfetto.
+// Each message shows as a send slice on the sending thread, an asynchronous queue-wait slice and a dispatch slice on
+// the device thread, connected by a flow arrow. Worker jobs and timer threads show as their own tracks. The file is
+// written while tracing, so it can be opened even when stop() is never called.
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmTracer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    FcmTracer(const FcmTracer&) = delete;
+    FcmTracer& operator=(const FcmTracer&) = delete;
+
+    static FcmTracer& getInstance()
+    {
+        static FcmTracer instance;
+        return instance;
+    }
+
+    void start(const std::string& path);
+    void stop();
+    [[nodiscard]] bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    // Names the track of the calling thread.
+    void nameThread(const std::string& threadName);
+
+    // Identifies a message in the trace, to be set before it is queued. A resent message gets a new one, its earlier
+    // queue wait ended when it was dispatched.
+    uint64_t newTraceId() { return nextTraceId.fetch_add(1, std::memory_order_relaxed); }
+
+    void traceSend(const FcmMessage& message, Clock::time_point begin, Clock::time_point end);
+    // The receiver is passed separately, as handling the message may have cleared it (see FcmDeadLetterQueue).
+    void traceDispatch(const FcmMessage& message,
+                       const void* receiver,
+                       const std::string& state,
+                       const std::string& nextState,
+                       Clock::time_point begin,
+                       Clock::time_point end);
+    // Ends the queue wait of a message that is dropped rather than dispatched.
+    void traceDrop(const FcmMessage& message, const std::string& reason);
+    void traceSlice(const std::string& sliceName,
+                    const std::string& category,
+                    Clock::time_point begin,
+                    Clock::time_point end);
+
+private:
+    FcmTracer() = default;
+
+    std::mutex mutex;
+    std::atomic<bool> enabled{false};
+    std::atomic<uint64_t> nextTraceId{1};
+    std::ofstream file;
+    std::string buffer;
+    bool firstEvent = true;
+    Clock::time_point origin;
+    std::map<int, std::string> threadNames;
+
+    void writeEvent(const std::string& event);
+    void writeThreadName(int threadId, const std::string& threadName);
+    void flush();
+    [[nodiscard]] std::string getTimestamp(Clock::time_point time) const;
+
+    static std::string getDuration(Clock::time_point begin, Clock::time_point end);
+    static int getThreadId();
+    static std::string escape(const std::string& text);
+};
+
+#endif //FCM_TRACER_H
@@ -0,0 +1,133 @@
+#ifndef FCM_WATCHDOG_H
+#define FCM_WATCHDOG_H
+
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+class FcmBaseComponent;
+
+// ---------------------------------------------------------------------------------------------------------------------
+enum class FcmActivityType
+{
+    Action,
+    ChoicePoint
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// An action or choice-point evaluation that exceeded the budget. It is reported by the watchdog thread while it is
+// still running (with a stack sample of the device thread when enabled) and by the device thread once it finished.
+// For a choice-point the state is the name of the choice-point and the message is the one that led to it.
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmWatchdogReport
+{
+    std::string componentName;
+    std::string state;
+    std::string interfaceName;
+    std::string messageName;
+    FcmActivityType type = FcmActivityType::Action;
+    int64_t elapsed = 0;  // Microseconds
+    bool finished = false;
+    std::vector<std::string> stackSample;
+};
+
+using FcmWatchdogReportFunction = std::function<void(const FcmWatchdogReport& report)>;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Longest time an action or choice-point evaluation took, per transition.
+// ---------------------------------------------------------------------------------------------------------------------
+struct FcmSlowTransition
+{
+    const FcmBaseComponent* component = nullptr;
+    std::string componentName;
+    std::string state;
+    std::string interfaceName;
+    std::string messageName;
+    FcmActivityType type = FcmActivityType::Action;
+    int64_t maxElapsed = 0;  // Microseconds
+};
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Watches the run-to-completion budget of the device thread. The device thread marks the begin and end of each action
+// and choice-point evaluation, a separate thread checks whether the running one exceeds the budget.
+//
+// To capture a stack sample the device thread is interrupted with a signal, SIGUSR2 unless another one is given. The
+// watchdog installs its handler for that signal from start() until it is destroyed, and restores the handler it
+// replaced; signals it did not send itself are passed on to that handler. Watchdogs of several devices share the
+// handler, so they have to use the same signal.
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmWatchdog
+{
+public:
+    FcmWatchdog(int64_t budgetParam,
+                FcmWatchdogReportFunction reportFunctionParam,
+                size_t topCountParam = 10,
+                bool captureStackParam = false,
+                int sampleSignalParam = 0);
+    FcmWatchdog(const FcmWatchdog&) = delete;
+    FcmWatchdog& operator=(const FcmWatchdog&) = delete;
+    ~FcmWatchdog();
+
+    // To be called on the device thread, which is the thread being watched.
+    void start();
+
+    void begin(FcmActivityType type,
+               const FcmBaseComponent* component,
+               const std::string& state,
+               const std::string& interfaceName,
+               const std::string& messageName);
+    void end();
+
+    [[nodiscard]] std::vector<FcmSlowTransition> getSlowestTransitions();
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    // The strings are owned by the device thread and only valid between begin() and end().
+    struct Activity
+    {
+        FcmActivityType type = FcmActivityType::Action;
+        const FcmBaseComponent* component = nullptr;
+        const std::string* state = nullptr;
+        const std::string* interfaceName = nullptr;
+        const std::string* messageName = nullptr;
+        Clock::time_point startTime;
+        bool active = false;
+        bool reported = false;
+    };
+
+    const int64_t budget;
+    const FcmWatchdogReportFunction reportFunction;
+    const size_t topCount;
+    const bool captureStack;
+    const int sampleSignal;  // 0 for SIGUSR2
+    bool signalHandlerInstalled = false;
+
+    std::mutex activityMutex;
+    Activity activity;
+
+    std::mutex slowestMutex;
+    std::vector<FcmSlowTransition> slowestTransitions;
+    std::atomic<int64_t> slowestThreshold{0};
+
+    std::mutex stopMutex;
+    std::condition_variable stopCondition;
+    bool stopRequested = false;
+    std::thread watchThread;
+    std::thread::native_handle_type deviceThread{};
+
+    void installSignalHandler();
+    void restoreSignalHandler();
+    void watch();
+    void updateSlowestTransitions(const Activity& finishedActivity, int64_t elapsed);
+    [[nodiscard]] FcmWatchdogReport makeReport(const Activity& reportedActivity, int64_t elapsed) const;
+    [[nodiscard]] std::vector<std::string> sampleStack() const;
+};
+
+#endif //FCM_WATCHDOG_H
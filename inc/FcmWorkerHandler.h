@@ -3,9 +3,12 @@
 
 #include <string>
 #include <atomic>
-#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
 
 #include "FcmAsyncInterfaceHandler.h"
+#include "FcmWorkerPool.h"
 
 // ---------------------------------------------------------------------------------------------------------------------
 class FcmWorkerHandler: public FcmAsyncInterfaceHandler
@@ -15,10 +18,10 @@ public:
 
     void initialize() override {}; // Override in derived classes if needed.
 
-    // Starts the worker thread
+    // Submits the job to the worker pool
     bool start();
 
-    // Cancels the worker thread
+    // Requests the job to stop, without waiting for it
     void cancel();
 
     virtual ~FcmWorkerHandler() override;
@@ -30,16 +33,35 @@ protected:
     // Method to be overridden by subclass to prepare the finished message
     virtual std::shared_ptr<FcmMessage> prepareFinishedMessage() = 0;
 
+    // To be polled by run() to stop early when the job is cancelled
+    [[nodiscard]] bool isCancelRequested() const { return cancelRequested; }
+
+    // Waits in run() until the deadline or until the job is cancelled, returns whether it was cancelled
+    bool waitUntilCancelled(std::chrono::steady_clock::time_point deadline);
+
+    // Sends a message from within run(), unless the job has been cancelled
+    bool sendPartialMessage(const std::shared_ptr<FcmMessage>& message);
+
+    // Called after run() has returned, before the finished message is sent
+    virtual void runFinished() {}
+
+    // Cancels the job and waits until it has finished. The base destructor does so too, but only after the members
+    // and overrides of the subclasses are gone, so a subclass the job uses calls it in its own destructor.
+    void cancelAndWait();
+
 private:
-    std::thread workerThread; // Empty thread object (not yet running)
+    std::mutex jobMutex;
+    std::condition_variable jobFinished;
+    std::condition_variable cancelCondition;
+    bool jobRunning = false;
+    bool restartRequested = false;
     std::atomic<bool> cancelRequested{false};
 
-    // Internal thread function that runs the worker
-    void threadRun();
+    // Internal function that runs the job on a pool thread
+    void jobRun();
 
     // Placeholder for the finished message
     std::shared_ptr<FcmMessage> finishedMessage;
 };
 
 #endif //FCM_WORKER_H
-
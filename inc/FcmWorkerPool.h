@@ -0,0 +1,57 @@
+#ifndef FCM_WORKER_POOL_H
+#define FCM_WORKER_POOL_H
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+using FcmJob = std::function<void()>;
+
+// ---------------------------------------------------------------------------------------------------------------------
+// Fixed-size pool of threads executing jobs submitted by the worker handlers. Every thread owns a job queue; idle
+// threads steal from the queues of the other threads.
+// ---------------------------------------------------------------------------------------------------------------------
+class FcmWorkerPool
+{
+public:
+    // A thread count of 0 selects the number of hardware threads.
+    explicit FcmWorkerPool(size_t threadCount = 0);
+    FcmWorkerPool(const FcmWorkerPool&) = delete;
+    FcmWorkerPool& operator=(const FcmWorkerPool&) = delete;
+    ~FcmWorkerPool();
+
+    static FcmWorkerPool& getInstance()
+    {
+        static FcmWorkerPool instance;
+        return instance;
+    }
+
+    void submit(FcmJob job);
+    [[nodiscard]] size_t size() const { return threads.size(); }
+
+private:
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<FcmJob> jobs;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> workQueues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> pendingJobs{0};
+    std::atomic<size_t> nextQueue{0};
+
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    bool stopping = false;
+
+    void threadRun(size_t index);
+    bool popJob(size_t index, FcmJob& job);
+};
+
+#endif //FCM_WORKER_POOL_H
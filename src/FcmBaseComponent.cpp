@@ -1,4 +1,5 @@
 #include <utility>
+#include <algorithm>
 
 #include "FcmBaseComponent.h"
 
@@ -14,43 +15,183 @@ FcmBaseComponent::FcmBaseComponent(std::string nameParam,
 void FcmBaseComponent::connectInterface(const std::string& interfaceName,
                                         FcmBaseComponent *remoteComponent)
 {
-    auto& componentList = interfaces[interfaceName];
+    {
+        std::unique_lock<std::shared_mutex> lock(connectionMutex);
+        auto& componentList = interfaces[interfaceName];
+
+        if (std::find(componentList.begin(), componentList.end(), remoteComponent) == componentList.end())
+        {
+            componentList.push_back(remoteComponent);
+            sentCounts[remoteComponent];
+            lock.unlock();
+
+            std::unique_lock<std::shared_mutex> remoteLock(remoteComponent->connectionMutex);
+            remoteComponent->connectedFrom.push_back(this);
+            return;
+        }
+    }
+
+    logError("Interface \"" + interfaceName +
+             "\" is already connected to component \"" +
+             remoteComponent->name + "\"!");
+}
 
-    if (std::find(componentList.begin(), componentList.end(), remoteComponent) != componentList.end())
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmBaseComponent::disconnectInterface(const std::string& interfaceName,
+                                           FcmBaseComponent* remoteComponent)
+{
     {
-        logError("Interface \"" + interfaceName +
-                 "\" is already connected to component \"" +
-                 remoteComponent->name + "\"!");
-        return;
+        std::unique_lock<std::shared_mutex> lock(connectionMutex);
+        auto interfaceIt = interfaces.find(interfaceName);
+        if (interfaceIt == interfaces.end())
+        {
+            return;
+        }
+
+        // The components connected after the remote component move down one index.
+        auto& componentList = interfaceIt->second;
+        auto componentIt = std::find(componentList.begin(), componentList.end(), remoteComponent);
+        if (componentIt == componentList.end())
+        {
+            return;
+        }
+        componentList.erase(componentIt);
+
+        // The counter goes with the last connection, the address may be reused by a component spawned later.
+        bool stillConnected = false;
+        for (const auto& [otherInterfaceName, otherComponentList] : interfaces)
+        {
+            if (std::find(otherComponentList.begin(), otherComponentList.end(), remoteComponent) !=
+                otherComponentList.end())
+            {
+                stillConnected = true;
+                break;
+            }
+        }
+        if (!stillConnected)
+        {
+            sentCounts.erase(remoteComponent);
+        }
     }
 
-    componentList.push_back(remoteComponent);
+    remoteComponent->removeConnectedFrom(this);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
-void FcmBaseComponent::sendMessage(const std::shared_ptr<FcmMessage>& message, size_t index)
+void FcmBaseComponent::disconnectAll()
 {
-    auto interfaceIt = interfaces.find(message->getInterfaceName());
-    if (interfaceIt == interfaces.end())
+    // Interfaces of other components connected to this component.
+    std::vector<FcmBaseComponent*> remoteComponents;
+    {
+        std::unique_lock<std::shared_mutex> lock(connectionMutex);
+        remoteComponents.swap(connectedFrom);
+    }
+    for (auto remoteComponent : remoteComponents)
+    {
+        remoteComponent->removeRemote(this);
+    }
+
+    // Interfaces of this component connected to other components.
+    std::vector<FcmBaseComponent*> connectedComponents;
+    {
+        std::unique_lock<std::shared_mutex> lock(connectionMutex);
+        for (auto& [interfaceName, componentList] : interfaces)
+        {
+            connectedComponents.insert(connectedComponents.end(), componentList.begin(), componentList.end());
+            componentList.clear();
+        }
+        sentCounts.clear();
+    }
+    for (auto connectedComponent : connectedComponents)
     {
-        logError("Trying to send message \"" + message->getName() +
-                 "\" to interface \"" + message->getInterfaceName() + "\" but the interface is not connected!");
-        return;
+        connectedComponent->removeConnectedFrom(this);
     }
+}
 
-    auto& componentList = interfaceIt->second;
-    if (index >= componentList.size())
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmBaseComponent::removeRemote(FcmBaseComponent* remoteComponent)
+{
+    // The locks of both components are never held at the same time, so the order of locking does not matter.
+    std::unique_lock<std::shared_mutex> lock(connectionMutex);
+    for (auto& [interfaceName, componentList] : interfaces)
     {
-        logError("Trying to send message \"" + message->getName() +
-                 "\" to interface \"" + message->getInterfaceName() + "\" on index " +
-                 std::to_string(index) + " but there are only " +
-                 std::to_string(componentList.size()) + " components connected!");
-        return;
+        componentList.erase(std::remove(componentList.begin(), componentList.end(), remoteComponent),
+                            componentList.end());
     }
+    sentCounts.erase(remoteComponent);
+}
 
-    message->receiver = componentList[index];
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmBaseComponent::removeConnectedFrom(FcmBaseComponent* remoteComponent)
+{
+    std::unique_lock<std::shared_mutex> lock(connectionMutex);
+    auto connectedFromIt = std::find(connectedFrom.begin(), connectedFrom.end(), remoteComponent);
+    if (connectedFromIt != connectedFrom.end())
+    {
+        connectedFrom.erase(connectedFromIt);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmBaseComponent::sendMessage(const std::shared_ptr<FcmMessage>& message, size_t index)
+{
+    size_t connectedCount;
+    {
+        std::shared_lock<std::shared_mutex> lock(connectionMutex);
+        auto interfaceIt = interfaces.find(message->getInterfaceName());
+        if (interfaceIt == interfaces.end())
+        {
+            lock.unlock();
+            logError("Trying to send message \"" + message->getName() +
+                     "\" to interface \"" + message->getInterfaceName() + "\" but the interface is not connected!");
+            return;
+        }
+
+        auto& componentList = interfaceIt->second;
+        connectedCount = componentList.size();
+        if (index < connectedCount)
+        {
+            sendMessageTo(message, componentList[index], index);
+            return;
+        }
+    }
+
+    logError("Trying to send message \"" + message->getName() +
+             "\" to interface \"" + message->getInterfaceName() + "\" on index " +
+             std::to_string(index) + " but there are only " +
+             std::to_string(connectedCount) + " components connected!");
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmBaseComponent::sendMessageTo(const std::shared_ptr<FcmMessage>& message,
+                                     FcmBaseComponent* receiver,
+                                     size_t index)
+{
+    // Called with the connection mutex held, so the receiver is still connected and not yet released.
+    message->receiver = receiver;
     message->interfaceIndex = index;
-    messageQueue.push(message);
+    message->receiverGeneration = receiver->slotGeneration;
+    message->sentGeneration = receiver->slotGeneration != nullptr ?
+                              receiver->slotGeneration->load(std::memory_order_relaxed) : 0;
+
+    if (countTraffic)
+    {
+        auto countIt = sentCounts.find(receiver);
+        if (countIt != sentCounts.end())
+        {
+            countIt->second.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // A receiver on another device gets the message through the channel of its queue.
+    if (&receiver->messageQueue == &messageQueue)
+    {
+        messageQueue.push(message);
+    }
+    else
+    {
+        receiver->messageQueue.pushRemote(message);
+    }
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
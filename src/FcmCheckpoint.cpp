@@ -0,0 +1,506 @@
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "FcmCheckpoint.h"
+#include "FcmFunctionalComponent.h"
+
+namespace
+{
+    const uint64_t checkpointMagic = 0x3354504b434d4346; // "FCMCKPT3"
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Checkpoint file contents, mapped into memory where the platform allows.
+    // -----------------------------------------------------------------------------------------------------------------
+    class CheckpointFile
+    {
+    public:
+        explicit CheckpointFile(const std::string& path)
+        {
+#ifdef __unix__
+            int fileDescriptor = open(path.c_str(), O_RDONLY);
+            if (fileDescriptor < 0)
+            {
+                throw std::runtime_error("Checkpoint \"" + path + "\" cannot be opened!");
+            }
+
+            struct stat fileStatus{};
+            if (fstat(fileDescriptor, &fileStatus) == 0 && fileStatus.st_size > 0)
+            {
+                size = static_cast<size_t>(fileStatus.st_size);
+                void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+                data = mapping == MAP_FAILED ? nullptr : static_cast<const char*>(mapping);
+            }
+            close(fileDescriptor);
+
+            if (data == nullptr)
+            {
+                throw std::runtime_error("Checkpoint \"" + path + "\" cannot be mapped!");
+            }
+#else
+            std::ifstream file(path, std::ios::binary);
+            if (!file)
+            {
+                throw std::runtime_error("Checkpoint \"" + path + "\" cannot be opened!");
+            }
+            contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            data = contents.data();
+            size = contents.size();
+#endif
+        }
+
+        CheckpointFile(const CheckpointFile&) = delete;
+        CheckpointFile& operator=(const CheckpointFile&) = delete;
+
+        ~CheckpointFile()
+        {
+#ifdef __unix__
+            munmap(const_cast<char*>(data), size);
+#endif
+        }
+
+        const char* data = nullptr;
+        size_t size = 0;
+
+    private:
+#ifndef __unix__
+        std::string contents;
+#endif
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+    struct MessageRecord
+    {
+        std::string interfaceName;
+        std::string name;
+        std::string receiverName;
+        std::string senderName;
+        int32_t interfaceIndex;
+        std::string payload;
+    };
+
+    struct ComponentRecord
+    {
+        std::string name;
+        std::string currentState;
+        std::string historyState;
+        std::vector<std::pair<std::string, std::string>> variables;
+        std::vector<MessageRecord> deferredMessages;
+    };
+
+    struct TimeoutRecord
+    {
+        int32_t timerId;
+        std::string componentName;
+        int64_t remaining;  // Microseconds
+        int64_t period;     // Microseconds, zero for a one-shot timeout
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void checkRead(bool success, const std::string& path)
+    {
+        if (!success)
+        {
+            throw std::runtime_error("Checkpoint \"" + path + "\" is corrupt!");
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Smallest encoded size of each record, strings being at least their length. A count that could not fit in the
+    // rest of the file is rejected before anything is allocated for it.
+    // -----------------------------------------------------------------------------------------------------------------
+    const size_t minimumComponentRecordSize = 3 * sizeof(uint32_t) + 2 * sizeof(uint32_t);
+    const size_t minimumVariableRecordSize = 2 * sizeof(uint32_t);
+    const size_t minimumMessageRecordSize = 5 * sizeof(uint32_t) + sizeof(int32_t);
+    const size_t minimumTimeoutRecordSize = sizeof(int32_t) + sizeof(uint32_t) + 2 * sizeof(int64_t);
+
+    bool readCount(FcmCheckpointReader& reader, size_t minimumRecordSize, uint32_t& count)
+    {
+        return reader.read(count) && count <= reader.getRemaining() / minimumRecordSize;
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // A component record decoded and checked against its component, ready to be applied.
+    // -----------------------------------------------------------------------------------------------------------------
+    struct StagedComponent
+    {
+        FcmFunctionalComponent* component;
+        const ComponentRecord* record;
+        std::vector<std::function<void()>> assignments;
+        std::vector<std::shared_ptr<FcmMessage>> deferredMessages;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+    bool readMessageRecord(FcmCheckpointReader& reader, MessageRecord& record)
+    {
+        return reader.read(record.interfaceName) &&
+               reader.read(record.name) &&
+               reader.read(record.receiverName) &&
+               reader.read(record.senderName) &&
+               reader.read(record.interfaceIndex) &&
+               reader.read(record.payload);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::map<std::string, FcmMessageSerializer>& FcmCheckpoint::getSerializers()
+{
+    static std::map<std::string, FcmMessageSerializer> serializers;
+    return serializers;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::mutex& FcmCheckpoint::getSerializersMutex()
+{
+    static std::mutex serializersMutex;
+    return serializersMutex;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmCheckpoint::registerBuiltinMessages()
+{
+    static std::once_flag builtinMessagesRegistered;
+    std::call_once(builtinMessagesRegistered, []() { registerMessage<Timer::Timeout>(&Timer::Timeout::timerId); });
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmCheckpoint::saveMessage(FcmCheckpointWriter& writer,
+                                const FcmMessage& message,
+                                const std::map<const void*, std::string>& componentNames)
+{
+    FcmCheckpointWriter payloadWriter;
+    {
+        std::lock_guard<std::mutex> lock(getSerializersMutex());
+        auto serializerIt = getSerializers().find(message.getInterfaceName() + ":" + message.getName());
+        if (serializerIt == getSerializers().end())
+        {
+            throw std::runtime_error("Message \"" + message.getInterfaceName() + ":" + message.getName() +
+                                     "\" cannot be saved, its type is not registered!");
+        }
+        serializerIt->second.save(message, payloadWriter);
+    }
+
+    auto receiverIt = componentNames.find(message.receiver);
+    auto senderIt = componentNames.find(message.sender);
+
+    writer.write(message.getInterfaceName());
+    writer.write(message.getName());
+    writer.write(receiverIt != componentNames.end() ? receiverIt->second : std::string());
+    writer.write(senderIt != componentNames.end() ? senderIt->second : std::string());
+    writer.write(static_cast<int32_t>(message.interfaceIndex));
+    writer.write(payloadWriter.getBuffer());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::shared_ptr<FcmMessage> FcmCheckpoint::loadMessage(const std::string& interfaceName,
+                                                       const std::string& messageName,
+                                                       const std::string& payload)
+{
+    std::lock_guard<std::mutex> lock(getSerializersMutex());
+    auto serializerIt = getSerializers().find(interfaceName + ":" + messageName);
+    if (serializerIt == getSerializers().end())
+    {
+        throw std::runtime_error("Message \"" + interfaceName + ":" + messageName +
+                                 "\" cannot be restored, its type is not registered!");
+    }
+
+    FcmCheckpointReader payloadReader(payload.data(), payload.size());
+    auto message = serializerIt->second.load(payloadReader);
+    if (message == nullptr || !payloadReader.atEnd())
+    {
+        throw std::runtime_error("Message \"" + interfaceName + ":" + messageName +
+                                 "\" cannot be restored from checkpoint!");
+    }
+    return message;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmCheckpoint::save(const std::string& path,
+                         const std::vector<FcmBaseComponent*>& components,
+                         FcmMessageQueue& messageQueue,
+                         FcmTimerHandler& timerHandler)
+{
+    registerBuiltinMessages();
+
+    std::map<const void*, std::string> componentNames;
+    for (auto component : components)
+    {
+        componentNames[component] = component->name;
+    }
+
+    FcmCheckpointWriter writer;
+    writer.write(checkpointMagic);
+
+    // Components
+    std::vector<FcmFunctionalComponent*> functionalComponents;
+    for (auto component : components)
+    {
+        if (component->getType() == FcmComponentType::Functional && !component->isDestroyed())
+        {
+            functionalComponents.push_back(static_cast<FcmFunctionalComponent*>(component));
+        }
+    }
+
+    writer.write(static_cast<uint32_t>(functionalComponents.size()));
+    for (auto component : functionalComponents)
+    {
+        writer.write(component->name);
+        writer.write(component->currentState);
+        writer.write(component->historyState);
+
+        writer.write(static_cast<uint32_t>(component->stateVariables.size()));
+        for (const auto& stateVariable : component->stateVariables)
+        {
+            FcmCheckpointWriter valueWriter;
+            stateVariable.save(valueWriter);
+            writer.write(stateVariable.name);
+            writer.write(valueWriter.getBuffer());
+        }
+
+        writer.write(static_cast<uint32_t>(component->deferredMessages.size()));
+        for (const auto& message : component->deferredMessages)
+        {
+            saveMessage(writer, *message, componentNames);
+        }
+    }
+
+    // Timeouts
+    std::vector<FcmArmedTimeout> armedTimeouts;
+    for (const auto& armedTimeout : timerHandler.getArmedTimeouts())
+    {
+        if (componentNames.find(armedTimeout.component) != componentNames.end())
+        {
+            armedTimeouts.push_back(armedTimeout);
+        }
+    }
+
+    writer.write(static_cast<uint32_t>(armedTimeouts.size()));
+    for (const auto& armedTimeout : armedTimeouts)
+    {
+        writer.write(static_cast<int32_t>(armedTimeout.timerId));
+        writer.write(componentNames[armedTimeout.component]);
+        writer.write(static_cast<int64_t>(armedTimeout.remaining.count()));
+        writer.write(static_cast<int64_t>(armedTimeout.period.count()));
+    }
+
+    // Messages, except those for components that are not saved (e.g. destroyed ones)
+    std::vector<std::shared_ptr<FcmMessage>> messages;
+    for (const auto& message : messageQueue.getMessages())
+    {
+        if (componentNames.find(message->receiver) != componentNames.end())
+        {
+            messages.push_back(message);
+        }
+    }
+
+    writer.write(static_cast<uint32_t>(messages.size()));
+    for (const auto& message : messages)
+    {
+        saveMessage(writer, *message, componentNames);
+    }
+
+    // Written next to the old checkpoint first, so a failure leaves the old checkpoint intact.
+    std::string temporaryPath = path + ".tmp";
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        file.write(writer.getBuffer().data(), static_cast<std::streamsize>(writer.getBuffer().size()));
+        if (!file)
+        {
+            throw std::runtime_error("Checkpoint \"" + temporaryPath + "\" cannot be written!");
+        }
+    }
+
+    if (std::rename(temporaryPath.c_str(), path.c_str()) != 0)
+    {
+        throw std::runtime_error("Checkpoint \"" + path + "\" cannot be replaced!");
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmCheckpoint::restore(const std::string& path,
+                            const std::vector<FcmBaseComponent*>& components,
+                            FcmMessageQueue& messageQueue,
+                            FcmTimerHandler& timerHandler)
+{
+    registerBuiltinMessages();
+
+    CheckpointFile file(path);
+    FcmCheckpointReader reader(file.data, file.size);
+
+    uint64_t magic = 0;
+    checkRead(reader.read(magic) && magic == checkpointMagic, path);
+
+    // The whole file is read and decoded before anything is applied, so a checkpoint that does not fit leaves the
+    // device as it is.
+    uint32_t count = 0;
+    checkRead(readCount(reader, minimumComponentRecordSize, count), path);
+    std::vector<ComponentRecord> componentRecords(count);
+    for (auto& record : componentRecords)
+    {
+        uint32_t variableCount = 0;
+        checkRead(reader.read(record.name) &&
+                  reader.read(record.currentState) &&
+                  reader.read(record.historyState) &&
+                  readCount(reader, minimumVariableRecordSize, variableCount), path);
+
+        record.variables.resize(variableCount);
+        for (auto& [variableName, value] : record.variables)
+        {
+            checkRead(reader.read(variableName) && reader.read(value), path);
+        }
+
+        uint32_t deferredCount = 0;
+        checkRead(readCount(reader, minimumMessageRecordSize, deferredCount), path);
+        record.deferredMessages.resize(deferredCount);
+        for (auto& messageRecord : record.deferredMessages)
+        {
+            checkRead(readMessageRecord(reader, messageRecord), path);
+        }
+    }
+
+    checkRead(readCount(reader, minimumTimeoutRecordSize, count), path);
+    std::vector<TimeoutRecord> timeoutRecords(count);
+    for (auto& record : timeoutRecords)
+    {
+        checkRead(reader.read(record.timerId) &&
+                  reader.read(record.componentName) &&
+                  reader.read(record.remaining) &&
+                  reader.read(record.period), path);
+    }
+
+    checkRead(readCount(reader, minimumMessageRecordSize, count), path);
+    std::vector<MessageRecord> messageRecords(count);
+    for (auto& record : messageRecords)
+    {
+        checkRead(readMessageRecord(reader, record), path);
+    }
+    checkRead(reader.atEnd(), path);
+
+    // Components, matched by name. Records of components that no longer exist are skipped.
+    std::map<std::string, FcmBaseComponent*> componentsByName;
+    for (auto component : components)
+    {
+        componentsByName[component->name] = component;
+    }
+
+    auto loadSender = [&componentsByName](const MessageRecord& record, FcmMessage& message)
+    {
+        auto senderIt = componentsByName.find(record.senderName);
+        message.sender = senderIt != componentsByName.end() ? senderIt->second : nullptr;
+        message.interfaceIndex = record.interfaceIndex;
+    };
+
+    std::vector<StagedComponent> stagedComponents;
+    for (const auto& record : componentRecords)
+    {
+        auto componentIt = componentsByName.find(record.name);
+        if (componentIt == componentsByName.end() ||
+            componentIt->second->getType() != FcmComponentType::Functional)
+        {
+            continue;
+        }
+
+        // A checkpoint of an earlier version of the component may refer to a state it no longer has.
+        auto component = static_cast<FcmFunctionalComponent*>(componentIt->second);
+        const auto& states = component->getStates();
+        auto hasState = [&states](const std::string& state)
+        {
+            return std::find(states.begin(), states.end(), state) != states.end();
+        };
+        if (!hasState(record.currentState) || (!record.historyState.empty() && !hasState(record.historyState)))
+        {
+            throw std::runtime_error("Checkpoint \"" + path + "\" refers to state \"" +
+                                     (hasState(record.currentState) ? record.historyState : record.currentState) +
+                                     "\", which component \"" + record.name + "\" does not have!");
+        }
+
+        StagedComponent staged{component, &record, {}, {}};
+        for (const auto& [variableName, value] : record.variables)
+        {
+            for (auto& stateVariable : component->stateVariables)
+            {
+                if (stateVariable.name != variableName)
+                {
+                    continue;
+                }
+
+                FcmCheckpointReader valueReader(value.data(), value.size());
+                auto assignment = stateVariable.load(valueReader);
+                if (!assignment || !valueReader.atEnd())
+                {
+                    throw std::runtime_error("State variable \"" + variableName + "\" of component \"" +
+                                             record.name + "\" cannot be restored from checkpoint!");
+                }
+                staged.assignments.push_back(std::move(assignment));
+            }
+        }
+
+        for (const auto& messageRecord : record.deferredMessages)
+        {
+            auto message = loadMessage(messageRecord.interfaceName, messageRecord.name, messageRecord.payload);
+            message->receiver = component;
+            loadSender(messageRecord, *message);
+            staged.deferredMessages.push_back(message);
+        }
+        stagedComponents.push_back(std::move(staged));
+    }
+
+    std::vector<std::shared_ptr<FcmMessage>> messages;
+    for (const auto& record : messageRecords)
+    {
+        auto receiverIt = componentsByName.find(record.receiverName);
+        if (receiverIt == componentsByName.end())
+        {
+            continue;
+        }
+
+        auto message = loadMessage(record.interfaceName, record.name, record.payload);
+        message->receiver = receiverIt->second;
+        loadSender(record, *message);
+        messages.push_back(message);
+    }
+
+    // Nothing below fails on the contents of the checkpoint.
+    for (auto& staged : stagedComponents)
+    {
+        auto component = staged.component;
+        component->currentState = staged.record->currentState;
+        component->historyState = staged.record->historyState;
+        for (const auto& assignment : staged.assignments)
+        {
+            assignment();
+        }
+        component->deferredMessages = std::move(staged.deferredMessages);
+
+        // Timeouts set during initialization are replaced by the ones of the checkpoint.
+        timerHandler.cancelComponentTimeouts(component);
+    }
+
+    for (const auto& record : timeoutRecords)
+    {
+        auto componentIt = componentsByName.find(record.componentName);
+        if (componentIt != componentsByName.end())
+        {
+            timerHandler.restoreTimeout(record.timerId,
+                                        FcmTimeMicroseconds(record.remaining),
+                                        FcmTimeMicroseconds(record.period),
+                                        componentIt->second);
+        }
+    }
+
+    // Messages, replacing the ones queued during initialization.
+    messageQueue.removeMessages([](const std::shared_ptr<FcmMessage>&) { return true; });
+    for (const auto& message : messages)
+    {
+        messageQueue.push(message);
+    }
+}
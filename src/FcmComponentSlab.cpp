@@ -0,0 +1,119 @@
+#include <new>
+#include <algorithm>
+
+#include "FcmComponentSlab.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmComponentSlab::FcmComponentSlab(size_t slotSizeParam, size_t slotAlignmentParam, size_t slotsPerChunkParam):
+    slotAlignment(slotAlignmentParam),
+    slotSize((slotSizeParam + slotAlignmentParam - 1) / slotAlignmentParam * slotAlignmentParam),
+    slotsPerChunk(slotsPerChunkParam)
+{
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmComponentSlab::~FcmComponentSlab()
+{
+    for (const auto& chunk : chunks)
+    {
+        if (chunk.memory != nullptr)
+        {
+            ::operator delete(chunk.memory, std::align_val_t(slotAlignment));
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void* FcmComponentSlab::allocate()
+{
+    if (freeSlots.empty())
+    {
+        size_t chunkIndex;
+        if (releasedChunks.empty())
+        {
+            chunkIndex = chunks.size();
+            chunks.emplace_back();
+            chunks.back().generations = std::make_unique<std::atomic<uint64_t>[]>(slotsPerChunk);
+        }
+        else
+        {
+            chunkIndex = releasedChunks.back();
+            releasedChunks.pop_back();
+        }
+
+        auto& chunk = chunks[chunkIndex];
+        chunk.memory = static_cast<std::byte*>(::operator new(slotSize * slotsPerChunk,
+                                                              std::align_val_t(slotAlignment)));
+        chunksByAddress[chunk.memory] = chunkIndex;
+
+        // Hand out the slots of the new chunk in address order.
+        for (size_t slot = slotsPerChunk; slot > 0; slot--)
+        {
+            freeSlots.push_back(chunk.memory + (slot - 1) * slotSize);
+        }
+    }
+
+    void* slot = freeSlots.back();
+    freeSlots.pop_back();
+    usedSlots++;
+
+    auto chunkIndex = findChunk(slot);
+    chunks[chunkIndex].usedSlots++;
+    if (spareChunk == chunkIndex)
+    {
+        spareChunk = SIZE_MAX;
+    }
+    return slot;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmComponentSlab::deallocate(void* slot)
+{
+    freeSlots.push_back(slot);
+    usedSlots--;
+
+    auto chunkIndex = findChunk(slot);
+    if (--chunks[chunkIndex].usedSlots > 0)
+    {
+        return;
+    }
+
+    // One empty chunk is kept, so a component spawned and destroyed repeatedly does not allocate each time.
+    if (spareChunk == SIZE_MAX)
+    {
+        spareChunk = chunkIndex;
+        return;
+    }
+    releaseChunk(chunkIndex);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::atomic<uint64_t>& FcmComponentSlab::getGeneration(void* slot) const
+{
+    const auto& chunk = chunks[findChunk(slot)];
+    return chunk.generations[static_cast<size_t>(static_cast<std::byte*>(slot) - chunk.memory) / slotSize];
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+size_t FcmComponentSlab::findChunk(const void* slot) const
+{
+    // The chunk starting at or before the slot.
+    auto chunkIt = chunksByAddress.upper_bound(static_cast<const std::byte*>(slot));
+    return std::prev(chunkIt)->second;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmComponentSlab::releaseChunk(size_t chunkIndex)
+{
+    auto& chunk = chunks[chunkIndex];
+    auto chunkEnd = chunk.memory + slotSize * slotsPerChunk;
+    freeSlots.erase(std::remove_if(freeSlots.begin(), freeSlots.end(), [&chunk, chunkEnd](void* slot)
+    {
+        return slot >= chunk.memory && slot < chunkEnd;
+    }), freeSlots.end());
+
+    chunksByAddress.erase(chunk.memory);
+    ::operator delete(chunk.memory, std::align_val_t(slotAlignment));
+    chunk.memory = nullptr;
+    releasedChunks.push_back(chunkIndex);
+}
@@ -0,0 +1,151 @@
+#include <stdexcept>
+#include <functional>
+
+#include "FcmDeadLetterQueue.h"
+#include "FcmBaseComponent.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmDeadLetterQueue::FcmDeadLetterQueue(size_t capacityParam,
+                                       uint64_t sampleIntervalParam,
+                                       size_t counterCapacityParam) :
+    capacity(capacityParam),
+    sampleInterval(sampleIntervalParam),
+    counterCapacity(counterCapacityParam)
+{
+    configure(capacityParam, sampleIntervalParam, counterCapacityParam);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDeadLetterQueue::configure(size_t capacityParam, uint64_t sampleIntervalParam, size_t counterCapacityParam)
+{
+    if (capacityParam == 0 || sampleIntervalParam == 0 || counterCapacityParam == 0)
+    {
+        throw std::runtime_error("Dead-letter queue needs a capacity, sample interval and counter capacity of at "
+                                 "least 1!");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = capacityParam;
+    sampleInterval = sampleIntervalParam;
+    counterCapacity = counterCapacityParam;
+    deadLetters.clear();
+    deadLetters.reserve(capacity);
+    nextIndex = 0;
+    counters.clear();
+    counts.clear();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+size_t FcmDeadLetterQueue::CountKeyHash::operator()(const CountKey& key) const
+{
+    size_t hash = 0;
+    for (auto text : {key.componentName, key.state, key.interfaceName, key.messageName})
+    {
+        hash ^= std::hash<std::string_view>()(text) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    }
+    return hash ^ static_cast<size_t>(key.reason);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool FcmDeadLetterQueue::record(const FcmBaseComponent* component,
+                                const std::string& state,
+                                const std::shared_ptr<FcmMessage>& message,
+                                FcmDeadLetterReason reason,
+                                uint64_t& count)
+{
+    CountKey key{component->name, state, message->getInterfaceName(), message->getName(), reason};
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto counterIt = counters.find(key);
+    if (counterIt != counters.end())
+    {
+        counts.splice(counts.begin(), counts, counterIt->second);
+    }
+    else
+    {
+        // The evicted key refers to the names of its count, so it is erased before the count is dropped.
+        if (counters.size() == counterCapacity)
+        {
+            const auto& evicted = *counts.back();
+            counters.erase(CountKey{evicted.componentName, evicted.state, evicted.interfaceName, evicted.messageName,
+                                    evicted.reason});
+            counts.pop_back();
+        }
+
+        counts.push_front(std::make_shared<FcmDeadLetterCount>(FcmDeadLetterCount{
+            component->name, state, message->getInterfaceName(), message->getName(), reason, 0}));
+        const auto& newCount = *counts.front();
+        CountKey storedKey{newCount.componentName, newCount.state, newCount.interfaceName, newCount.messageName,
+                           reason};
+        counters.emplace(storedKey, counts.begin());
+    }
+    const auto& deadLetterCount = counts.front();
+    count = ++deadLetterCount->count;
+    totalCount++;
+
+    message->sender = nullptr;
+    message->receiver = nullptr;
+
+    // The ring is filled up to its capacity first, then the oldest entry is overwritten.
+    RecordedLetter deadLetter{message, deadLetterCount};
+    if (deadLetters.size() < capacity)
+    {
+        deadLetters.push_back(std::move(deadLetter));
+    }
+    else
+    {
+        deadLetters[nextIndex] = std::move(deadLetter);
+    }
+    nextIndex = (nextIndex + 1) % capacity;
+
+    return count == 1 || count % sampleInterval == 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::vector<FcmDeadLetter> FcmDeadLetterQueue::getDeadLetters() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Until the ring is full the oldest entry is the first one.
+    size_t oldest = deadLetters.size() < capacity ? 0 : nextIndex;
+    std::vector<FcmDeadLetter> ordered;
+    ordered.reserve(deadLetters.size());
+    for (size_t offset = 0; offset < deadLetters.size(); offset++)
+    {
+        const auto& deadLetter = deadLetters[(oldest + offset) % deadLetters.size()];
+        ordered.push_back(FcmDeadLetter{deadLetter.message, deadLetter.count->componentName, deadLetter.count->state,
+                                        deadLetter.count->reason});
+    }
+    return ordered;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::vector<FcmDeadLetterCount> FcmDeadLetterQueue::getCounts() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<FcmDeadLetterCount> ordered;
+    ordered.reserve(counts.size());
+    for (const auto& deadLetterCount : counts)
+    {
+        ordered.push_back(*deadLetterCount);
+    }
+    return ordered;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+uint64_t FcmDeadLetterQueue::getTotalCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return totalCount;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDeadLetterQueue::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    deadLetters.clear();
+    nextIndex = 0;
+    totalCount = 0;
+    counters.clear();
+    counts.clear();
+}
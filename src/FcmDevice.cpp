@@ -1,22 +1,255 @@
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include "FcmDevice.h"
 #include "FcmFunctionalComponent.h"
+#include "FcmTracer.h"
 
 // ---------------------------------------------------------------------------------------------------------------------
 FcmDevice::FcmDevice() :
-    messageQueue(FcmMessageQueue::getInstance())
+    timerHandler(messageQueue)
+{
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmDevice::~FcmDevice()
 {
+    while (!spawnedComponents.empty())
+    {
+        releaseComponent(spawnedComponents.begin()->first);
+    }
+    components.clear();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 void FcmDevice::run()
 {
+    prepareRun();
+
     while (true)
     {
         auto message = messageQueue.awaitMessage();
+        passQuiescentState();
+        if (isStopMarker(*message))
+        {
+            // Never stops, the request is dropped rather than left to stop a later runUntilStopped().
+            stopRequested = false;
+            continue;
+        }
         processMessages(message);
+        passQuiescentState();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::runUntilStopped()
+{
+    prepareRun();
+
+    while (true)
+    {
+        auto message = messageQueue.awaitMessage();
+        passQuiescentState();
+        if (isStopMarker(*message))
+        {
+            // A marker without a pending request, e.g. one whose request run() dropped, is skipped.
+            if (stopRequested.exchange(false))
+            {
+                return;
+            }
+            continue;
+        }
+        processMessages(message);
+        passQuiescentState();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::stop()
+{
+    // The marker wakes up the device thread, which returns when it comes up. Repeated requests before that share it.
+    if (!stopRequested.exchange(true))
+    {
+        messageQueue.push(std::make_shared<Device::Stop>());
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool FcmDevice::isStopMarker(const FcmMessage& message)
+{
+    return message.receiver == nullptr && message.sender == nullptr &&
+           message.getInterfaceName() == Device::interfaceClassName && message.getName() == Device::Stop::name;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::prepareRun()
+{
+    applyCpuAffinity();
+    FcmTracer::getInstance().nameThread("Device");
+
+    if (watchdog)
+    {
+        for (const auto& component : components)
+        {
+            if (component->getType() == FcmComponentType::Functional)
+            {
+                static_cast<FcmFunctionalComponent*>(component.get())->watchdog = watchdog.get();
+            }
+        }
+        watchdog->start();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::setWaitStrategy(FcmWaitStrategy strategy, unsigned int spins, unsigned int yields)
+{
+    messageQueue.setWaitStrategy(strategy, spins, yields);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::setSchedulingMode(FcmSchedulingMode mode, int64_t quantum)
+{
+    messageQueue.setSchedulingMode(mode, quantum);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::setComponentQuota(const FcmBaseComponent* component, unsigned int quota)
+{
+    messageQueue.setReceiverQuota(component, quota);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::map<std::string, FcmReceiverStatistics> FcmDevice::getSchedulingStatistics() const
+{
+    auto receiverStatistics = messageQueue.getReceiverStatistics();
+
+    std::map<std::string, FcmReceiverStatistics> statistics;
+    for (auto component : getAllComponents())
+    {
+        auto statisticsIt = receiverStatistics.find(component);
+        if (statisticsIt != receiverStatistics.end())
+        {
+            statistics[component->name] = statisticsIt->second;
+        }
+    }
+    return statistics;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::setWatchdog(int64_t budget,
+                            const FcmWatchdogReportFunction& reportFunction,
+                            size_t topCount,
+                            bool captureStack,
+                            int sampleSignal)
+{
+    watchdog = std::make_unique<FcmWatchdog>(budget, reportFunction, topCount, captureStack, sampleSignal);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::vector<FcmSlowTransition> FcmDevice::getSlowestTransitions() const
+{
+    if (!watchdog)
+    {
+        return {};
+    }
+    return watchdog->getSlowestTransitions();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::setSettingsSchema(const FcmSettingsSchema& schema)
+{
+    settingsStore = std::make_unique<FcmSettingsStore>(schema, settings);
+    for (auto component : getAllComponents())
+    {
+        component->settingsStore = settingsStore.get();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::updateSettings(const FcmSettings& changes)
+{
+    if (!settingsStore)
+    {
+        throw std::runtime_error("Device has no settings schema to update!");
+    }
+    settingsStore->update(changes);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::shared_ptr<const FcmSettingsSnapshot> FcmDevice::acquireSettings() const
+{
+    if (!settingsStore)
+    {
+        throw std::runtime_error("Device has no settings schema!");
+    }
+    return settingsStore->acquire();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::passQuiescentState()
+{
+    // No action is running, so none refers to a replaced settings snapshot. Passed after waiting as well, so that a
+    // device idle during an update handles the next message with the new snapshot.
+    if (settingsStore)
+    {
+        settingsStore->quiescentState();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::configureDeadLetters(size_t capacity, uint64_t sampleInterval, size_t counterCapacity)
+{
+    deadLetterQueue.configure(capacity, sampleInterval, counterCapacity);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::setTrafficCounting(bool enabled)
+{
+    trafficCounting = enabled;
+    for (auto component : getAllComponents())
+    {
+        component->countTraffic = enabled;
     }
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::resetTrafficCounts()
+{
+    std::lock_guard<std::mutex> lock(componentsMutex);
+    for (auto component : collectComponents())
+    {
+        std::shared_lock<std::shared_mutex> connectionLock(component->connectionMutex);
+        for (auto& [receiver, count] : component->sentCounts)
+        {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::applyCpuAffinity() const
+{
+    if (!cpuAffinity.has_value())
+    {
+        return;
+    }
+
+#ifdef __linux__
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(cpuAffinity.value(), &cpuSet);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) != 0)
+    {
+        throw std::runtime_error("Device thread could not be pinned to CPU " +
+                                 std::to_string(cpuAffinity.value()) + "!");
+    }
+#else
+    throw std::runtime_error("Pinning the device thread is not supported on this platform!");
+#endif
+}
+
 //  ---------------------------------------------------------------------------------------------------------------------
 void FcmDevice::initializeComponents()
 {
@@ -34,12 +267,155 @@ void FcmDevice::processMessages(std::shared_ptr<FcmMessage>& message)
 
     if (receiver == nullptr)
     {
-        auto errorMessage = "Sent the message \"" + message->getName() +
-                            "\" to unconnected interface \"" + message->getInterfaceName() + "\"!";
-        sender->logError(errorMessage);
+        static const std::string noState;
+        const auto& state = sender->getType() == FcmComponentType::Functional ?
+                            static_cast<FcmFunctionalComponent*>(sender)->currentState : noState;
+
+        uint64_t count;
+        if (deadLetterQueue.record(sender, state, message, FcmDeadLetterReason::Unconnected, count))
+        {
+            auto errorMessage = "Sent the message \"" + message->getName() +
+                                "\" to unconnected interface \"" + message->getInterfaceName() + "\"!";
+            if (count > 1)
+            {
+                errorMessage += " (" + std::to_string(count) + " times)";
+            }
+            sender->logError(errorMessage);
+        }
+        FcmTracer::getInstance().traceDrop(*message, "unconnected");
+        return;
+    }
+
+    // Sent to a component destroyed since, which may already be released: the receiver is not to be touched.
+    if (message->isStale())
+    {
+        FcmTracer::getInstance().traceDrop(*message, "stale");
+        return;
+    }
+
+    if (receiver->isDestroyed())
+    {
+        FcmTracer::getInstance().traceDrop(*message, "destroyed");
+        // Messages queued before the destruction are dropped, the marker releases the component.
+        if (message->getInterfaceName() == Device::interfaceClassName &&
+            message->getName() == Device::ComponentDestroyed::name)
+        {
+            releaseComponent(receiver);
+        }
+        return;
+    }
+
+    auto& tracer = FcmTracer::getInstance();
+    if (!tracer.isEnabled())
+    {
+        receiver->processMessage(message);
         return;
     }
+
+    auto state = receiver->currentState;
+    auto dispatchTime = FcmTracer::Clock::now();
     receiver->processMessage(message);
+    tracer.traceDispatch(*message, receiver, state, receiver->currentState, dispatchTime, FcmTracer::Clock::now());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::initializeComponent(FcmBaseComponent* component)
+{
+    component->_initialize();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::destroyComponent(FcmBaseComponent* component)
+{
+    if (spawnedComponents.find(component) == spawnedComponents.end())
+    {
+        throw std::runtime_error("Component \"" + component->name + "\" was not spawned and cannot be destroyed!");
+    }
+
+    if (component->destroyed)
+    {
+        return;
+    }
+
+    // Once disconnected, nothing more is sent to the component. Changing the generation of its slot then makes all
+    // messages sent to it stale, also the ones from other devices that reach the queue after the marker.
+    {
+        std::lock_guard<std::mutex> lock(componentsMutex);
+        component->destroyed = true;
+    }
+    component->disconnectAll();
+    component->slotGeneration->fetch_add(1, std::memory_order_release);
+    timerHandler.cancelComponentTimeouts(component);
+
+    // Rather than searching the queue for messages to the component, they are dropped when they come up. The
+    // component is released when this marker comes up, after the current action has returned.
+    auto destroyedMessage = std::make_shared<Device::ComponentDestroyed>();
+    destroyedMessage->receiver = component;
+    messageQueue.push(destroyedMessage);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::releaseComponent(FcmBaseComponent* component)
+{
+    SpawnedComponent spawned{};
+    {
+        std::lock_guard<std::mutex> lock(componentsMutex);
+        auto spawnedIt = spawnedComponents.find(component);
+        spawned = spawnedIt->second;
+        spawnedComponents.erase(spawnedIt);
+    }
+    messageQueue.removeReceiver(component);
+
+    component->~FcmBaseComponent();
+    spawned.slab->deallocate(spawned.memory);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::saveCheckpoint(const std::string& path)
+{
+    FcmCheckpoint::save(path, getAllComponents(), messageQueue, timerHandler);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmDevice::restoreCheckpoint(const std::string& path)
+{
+    FcmCheckpoint::restore(path, getAllComponents(), messageQueue, timerHandler);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::vector<FcmBaseComponent*> FcmDevice::getAllComponents() const
+{
+    std::lock_guard<std::mutex> lock(componentsMutex);
+    return collectComponents();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::vector<FcmBaseComponent*> FcmDevice::collectComponents() const
+{
+    std::vector<FcmBaseComponent*> allComponents;
+    for (const auto& component : components)
+    {
+        allComponents.push_back(component.get());
+    }
+    for (const auto& [component, spawned] : spawnedComponents)
+    {
+        if (!component->isDestroyed())
+        {
+            allComponents.push_back(component);
+        }
+    }
+    return allComponents;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmComponentSlab& FcmDevice::getSlab(size_t size, size_t alignment)
+{
+    auto& slab = slabs[{size, alignment}];
+    if (!slab)
+    {
+        slab = std::make_unique<FcmComponentSlab>(size, alignment);
+    }
+    return *slab;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -0,0 +1,37 @@
+#include "FcmDeviceContext.h"
+#include "FcmMessageQueue.h"
+#include "FcmTimerHandler.h"
+
+namespace
+{
+    thread_local FcmMessageQueue* currentMessageQueue = nullptr;
+    thread_local FcmTimerHandler* currentTimerHandler = nullptr;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmDeviceContext::FcmDeviceContext(FcmMessageQueue& messageQueue, FcmTimerHandler& timerHandler):
+    previousMessageQueue(currentMessageQueue),
+    previousTimerHandler(currentTimerHandler)
+{
+    currentMessageQueue = &messageQueue;
+    currentTimerHandler = &timerHandler;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmDeviceContext::~FcmDeviceContext()
+{
+    currentMessageQueue = previousMessageQueue;
+    currentTimerHandler = previousTimerHandler;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmMessageQueue& FcmDeviceContext::getMessageQueue()
+{
+    return currentMessageQueue != nullptr ? *currentMessageQueue : FcmMessageQueue::getInstance();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmTimerHandler& FcmDeviceContext::getTimerHandler()
+{
+    return currentTimerHandler != nullptr ? *currentTimerHandler : FcmTimerHandler::getInstance();
+}
@@ -1,4 +1,9 @@
+#include <algorithm>
+#include <mutex>
+#include <typeindex>
+
 #include "FcmFunctionalComponent.h"
+#include "FcmTracer.h"
 
 // ---------------------------------------------------------------------------------------------------------------------
 FcmFunctionalComponent::FcmFunctionalComponent(const std::string& nameParam,
@@ -11,6 +16,15 @@ FcmFunctionalComponent::FcmFunctionalComponent(const std::string& nameParam,
 // ---------------------------------------------------------------------------------------------------------------------
 void FcmFunctionalComponent::_initialize()
 {
+    if (sharesTables())
+    {
+        buildSharedTables();
+        currentState = sharedTables->states[0];
+        findBatchTransitions();
+        initialize();
+        return;
+    }
+
     setStates();
     if (states.empty())
     {
@@ -26,9 +40,68 @@ void FcmFunctionalComponent::_initialize()
         throw std::runtime_error("State transition table is empty for component \"" + name + "\"!");
     }
 
+    findBatchTransitions();
     initialize();
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmFunctionalComponent::findBatchTransitions()
+{
+    hasBatchTransitions = false;
+    for (const auto& [stateName, interfaces] : getStateTransitionTable())
+    {
+        for (const auto& [interfaceName, messages] : interfaces)
+        {
+            for (const auto& [messageName, transition] : messages)
+            {
+                hasBatchTransitions = hasBatchTransitions || transition.batchAction;
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmFunctionalComponent::buildSharedTables()
+{
+    static std::mutex registryMutex;
+    static std::map<std::type_index, std::shared_ptr<const FcmComponentTables>> registry;
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    auto registryIt = registry.find(typeid(*this));
+    if (registryIt != registry.end())
+    {
+        sharedTables = registryIt->second;
+        return;
+    }
+
+    // The first instance of the class builds the tables in its own members and hands them over.
+    setStates();
+    if (states.empty())
+    {
+        throw std::runtime_error("No states defined for component \"" + name + "\"!");
+    }
+
+    setChoicePoints();
+
+    setTransitions();
+    if (stateTransitionTable.empty())
+    {
+        throw std::runtime_error("State transition table is empty for component \"" + name + "\"!");
+    }
+
+    auto tables = std::make_shared<FcmComponentTables>();
+    tables->states = std::move(states);
+    tables->stateTransitionTable = std::move(stateTransitionTable);
+    tables->choicePointTable = std::move(choicePointTable);
+    states.clear();
+    stateTransitionTable.clear();
+    choicePointTable.clear();
+
+    sharedTables = tables;
+    registry.emplace(typeid(*this), sharedTables);
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 void FcmFunctionalComponent::addTransition(const std::string& stateName,
                                            const std::string& interfaceName,
@@ -36,6 +109,66 @@ void FcmFunctionalComponent::addTransition(const std::string& stateName,
                                            const std::string& nextState,
                                            const FcmSttAction& action)
 {
+    if (sharesTables())
+    {
+        throw std::runtime_error("Transition \"" + interfaceName + ":" + messageName + "\" on state \"" + stateName +
+                                 "\" of component \"" + name + "\" must be bound, the tables are shared!");
+    }
+
+    insertTransition(stateName, interfaceName, messageName, FcmSttTransition{action, nextState, nullptr, false, nullptr, 0});
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmFunctionalComponent::addBoundTransition(const std::string& stateName,
+                                                const std::string& interfaceName,
+                                                const std::string& messageName,
+                                                const std::string& nextState,
+                                                const FcmSttBoundAction& action)
+{
+    insertTransition(stateName, interfaceName, messageName, FcmSttTransition{nullptr, nextState, action, false, nullptr, 0});
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmFunctionalComponent::addDeferral(const std::string& stateName,
+                                         const std::string& interfaceName,
+                                         const std::string& messageName)
+{
+    insertTransition(stateName, interfaceName, messageName, FcmSttTransition{nullptr, stateName, nullptr, true, nullptr, 0});
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmFunctionalComponent::addBatchTransition(const std::string& stateName,
+                                                const std::string& interfaceName,
+                                                const std::string& messageName,
+                                                const std::string& nextState,
+                                                const FcmSttBatchAction& action,
+                                                size_t maxBatchSize,
+                                                bool bound)
+{
+    if (!bound && sharesTables())
+    {
+        throw std::runtime_error("Batch transition \"" + interfaceName + ":" + messageName + "\" on state \"" +
+                                 stateName + "\" of component \"" + name + "\" must be bound, the tables are shared!");
+    }
+
+    if (maxBatchSize == 0)
+    {
+        throw std::runtime_error("Batch transition \"" + interfaceName + ":" + messageName + "\" on state \"" +
+                                 stateName + "\" of component \"" + name + "\" must allow at least one message!");
+    }
+
+    insertTransition(stateName, interfaceName, messageName,
+                     FcmSttTransition{nullptr, nextState, nullptr, false, action, maxBatchSize});
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmFunctionalComponent::insertTransition(const std::string& stateName,
+                                              const std::string& interfaceName,
+                                              const std::string& messageName,
+                                              FcmSttTransition transition)
+{
+    const auto& nextState = transition.nextState;
+
     // Check if the state exists in the state transition table.
     if (stateName != "*" &&
         std::find(states.begin(), states.end(), stateName) == states.end() )
@@ -43,51 +176,69 @@ void FcmFunctionalComponent::addTransition(const std::string& stateName,
         throw std::runtime_error("State \"" + stateName + "\" for component \"" + name + "\" does not exist!");
     }
 
-    if (nextState != "H" &&
+    if (!transition.deferred && nextState != "H" &&
         std::find(states.begin(), states.end(), nextState) == states.end())
     {
         throw std::runtime_error("Next state \"" + nextState + "\" for component \"" + name + "\" does not exist!");
     }
 
-    if (stateTransitionTable.find(stateName) == stateTransitionTable.end())
+    auto& messages = stateTransitionTable[stateName][interfaceName];
+    if (messages.find(messageName) != messages.end())
     {
-        stateTransitionTable[stateName] = FcmSttInterfaces();
+        throw std::runtime_error( "Transition \"" + interfaceName + ":" + messageName +
+        "\" on state \"" + stateName + "\" already exists for component \"" + name + "\"!");
     }
 
-    if (stateTransitionTable[stateName].find(interfaceName) == stateTransitionTable[stateName].end())
-    {
-        stateTransitionTable[stateName][interfaceName] = FcmSttMessages();
-    }
+    messages[messageName] = std::move(transition);
+}
 
-    if (stateTransitionTable[stateName][interfaceName].find(messageName) != 
-        stateTransitionTable[stateName][interfaceName].end())
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmFunctionalComponent::addChoicePoint(const std::string& choicePointName,
+                                            const FcmSttEvaluation& evaluationFunction)
+{
+    if (sharesTables())
     {
-        throw std::runtime_error( "Transition \"" + interfaceName + ":" + messageName + 
-        "\" on state \"" + stateName + "\" already exists for component \"" + name + "\"!");
+        throw std::runtime_error("Choice-point \"" + choicePointName + "\" of component \"" + name +
+                                 "\" must be bound, the tables are shared!");
     }
 
-    stateTransitionTable[stateName][interfaceName][messageName] = FcmSttTransition{action, nextState};
+    insertChoicePoint(choicePointName, FcmSttChoicePoint{evaluationFunction, nullptr});
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
-void FcmFunctionalComponent::addChoicePoint(const std::string& choicePointName,
-                                            const FcmSttEvaluation& evaluationFunction)
+void FcmFunctionalComponent::addBoundChoicePoint(const std::string& choicePointName,
+                                                 const FcmSttBoundEvaluation& evaluationFunction)
+{
+    insertChoicePoint(choicePointName, FcmSttChoicePoint{nullptr, evaluationFunction});
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmFunctionalComponent::insertChoicePoint(const std::string& choicePointName, FcmSttChoicePoint choicePoint)
 {
     if (choicePointTable.find(choicePointName) != choicePointTable.end())
     {
         throw std::runtime_error("Choice-point \"" + choicePointName +
             "\" already exists for component \"" + name + "\"!");
     }
-    choicePointTable[choicePointName] = evaluationFunction;
+    choicePointTable[choicePointName] = std::move(choicePoint);
     states.push_back(choicePointName);
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
-bool FcmFunctionalComponent::evaluateChoicePoint(const std::string &choicePointName) const
+bool FcmFunctionalComponent::evaluateChoicePoint(const std::string &choicePointName)
 {
-    FcmSttEvaluation choicePointEvaluationFunction;
-    choicePointEvaluationFunction = choicePointTable.at(choicePointName);
-    return choicePointEvaluationFunction();
+    const auto& choicePoint = getChoicePointTable().at(choicePointName);
+    if (watchdog == nullptr)
+    {
+        return choicePoint.boundEvaluation ? choicePoint.boundEvaluation(*this) : choicePoint.evaluation();
+    }
+
+    auto interfaceName = lastReceivedMessage->getInterfaceName();
+    auto messageName = lastReceivedMessage->getName();
+    watchdog->begin(FcmActivityType::ChoicePoint, this, choicePointName, interfaceName, messageName);
+    bool result = choicePoint.boundEvaluation ? choicePoint.boundEvaluation(*this) : choicePoint.evaluation();
+    watchdog->end();
+    return result;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -95,20 +246,26 @@ bool FcmFunctionalComponent::performTransition(const std::shared_ptr<FcmMessage>
 {
     auto interfaceName = message->getInterfaceName();
     auto messageName = message->getName();
-    std::string notFoundReason;
 
     // Find the action for the current state, interface and message.
-    auto transition = getTransition(currentState, interfaceName, messageName, &notFoundReason);
+    auto transition = getTransition(currentState, interfaceName, messageName);
 
-    if (!transition.has_value())
+    if (transition == nullptr)
     {
         // Try to look for a wildcard state.
         transition = getTransition("*", interfaceName, messageName);
     }
 
-    if (!transition.has_value())
+    if (transition == nullptr)
+    {
+        reportUnhandledMessage(message);
+        return false;
+    }
+
+    if (transition->deferred)
     {
-        logError(notFoundReason);
+        // Held until the state changes, see processMessage().
+        deferredMessages.push_back(message);
         return false;
     }
 
@@ -128,23 +285,160 @@ bool FcmFunctionalComponent::performTransition(const std::shared_ptr<FcmMessage>
             "\"");
     }
 
-    transition->action(message);
+    if (watchdog != nullptr)
+    {
+        watchdog->begin(FcmActivityType::Action, this, currentState, interfaceName, messageName);
+    }
+
+    if (transition->boundAction)
+    {
+        transition->boundAction(*this, message);
+    }
+    else if (transition->batchAction)
+    {
+        transition->batchAction(*this, &message, 1);
+    }
+    else
+    {
+        transition->action(message);
+    }
+
+    if (watchdog != nullptr)
+    {
+        watchdog->end();
+    }
     currentState = nextState;
     return true;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmFunctionalComponent::reportUnhandledMessage(const std::shared_ptr<FcmMessage>& message)
+{
+    uint64_t count = 1;
+    if (deadLetterQueue != nullptr &&
+        !deadLetterQueue->record(this, currentState, message, FcmDeadLetterReason::NoTransition, count))
+    {
+        return;
+    }
+
+    if (!logErrorFunction.has_value())
+    {
+        return;
+    }
+
+    // The reason is only put together for the occurrences that are logged.
+    std::string notFoundReason;
+    (void)getTransition(currentState, message->getInterfaceName(), message->getName(), &notFoundReason);
+    if (count > 1)
+    {
+        notFoundReason += " (" + std::to_string(count) + " times)";
+    }
+    logError(notFoundReason);
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 void FcmFunctionalComponent::processMessage(const std::shared_ptr<FcmMessage>& message)
 {
     lastReceivedMessage = message;
     historyState = currentState;
 
+    if (!hasBatchTransitions || !performBatchTransition(message))
+    {
+        performTransitions(message);
+    }
+
+    // Deferred messages get another chance in the new state, ahead of the other queued messages.
+    if (!deferredMessages.empty() && currentState != historyState)
+    {
+        messageQueue.resendMessages(deferredMessages);
+        deferredMessages.clear();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmFunctionalComponent::performTransitions(const std::shared_ptr<FcmMessage>& message)
+{
     if (!performTransition(message))
     {
         return;
     }
 
-    while (choicePointTable.find(currentState) != choicePointTable.end())
+    evaluateChoicePoints();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool FcmFunctionalComponent::performBatchTransition(const std::shared_ptr<FcmMessage>& message)
+{
+    auto interfaceName = message->getInterfaceName();
+    auto messageName = message->getName();
+
+    auto transition = getTransition(currentState, interfaceName, messageName);
+    if (transition == nullptr)
+    {
+        transition = getTransition("*", interfaceName, messageName);
+    }
+
+    // Anything but a batch transition that stays in a plain state is handled one message at a time.
+    if (transition == nullptr || !transition->batchAction)
+    {
+        return false;
+    }
+
+    std::string nextState = transition->nextState == "H" ? historyState : transition->nextState;
+    const auto& activeChoicePointTable = getChoicePointTable();
+    if (nextState != currentState || activeChoicePointTable.find(currentState) != activeChoicePointTable.end())
+    {
+        return false;
+    }
+
+    batchMessages.clear();
+    batchMessages.push_back(message);
+    messageQueue.takeRun(*message, transition->maxBatchSize - 1, batchMessages);
+    lastReceivedMessage = batchMessages.back();
+
+    if (logTransitionFunction.has_value())
+    {
+        logTransitionFunction.value()(getLogPrefix("TRANSACTION") +
+            "State: \"" + currentState +
+            "\" Interface: \"" + interfaceName +
+            "\" Message: \"" + messageName +
+            "\" Count: " + std::to_string(batchMessages.size()) +
+            " Next state: \"" + nextState +
+            "\"");
+    }
+
+    if (watchdog != nullptr)
+    {
+        watchdog->begin(FcmActivityType::Action, this, currentState, interfaceName, messageName);
+    }
+
+    transition->batchAction(*this, batchMessages.data(), batchMessages.size());
+
+    if (watchdog != nullptr)
+    {
+        watchdog->end();
+    }
+
+    // The device only knows about the first message of the run.
+    auto& tracer = FcmTracer::getInstance();
+    if (tracer.isEnabled())
+    {
+        auto dispatchTime = FcmTracer::Clock::now();
+        for (size_t index = 1; index < batchMessages.size(); index++)
+        {
+            tracer.traceDispatch(*batchMessages[index], this, currentState, nextState, dispatchTime, dispatchTime);
+        }
+    }
+
+    batchMessages.clear();
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmFunctionalComponent::evaluateChoicePoints()
+{
+    const auto& activeChoicePointTable = getChoicePointTable();
+    while (activeChoicePointTable.find(currentState) != activeChoicePointTable.end())
     {
         bool result = evaluateChoicePoint(currentState);
 
@@ -171,20 +465,21 @@ void FcmFunctionalComponent::resendLastReceivedMessage()
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
-std::optional<FcmSttTransition> FcmFunctionalComponent::getTransition(const std::string& stateName,
-                                                                      const std::string& interfaceName,
-                                                                      const std::string& messageName,
-                                                                            std::string* notFoundReason) const
+const FcmSttTransition* FcmFunctionalComponent::getTransition(const std::string& stateName,
+                                                              const std::string& interfaceName,
+                                                              const std::string& messageName,
+                                                                    std::string* notFoundReason) const
 {
-    auto state_it = stateTransitionTable.find(stateName);
-    if (state_it == stateTransitionTable.end())
+    const auto& activeTransitionTable = getStateTransitionTable();
+    auto state_it = activeTransitionTable.find(stateName);
+    if (state_it == activeTransitionTable.end())
     {
         if (notFoundReason != nullptr)
         {
             *notFoundReason = "Transition with begin state \"" + stateName + "\" for component \"" + name +
                               "\" does not exist in state-transition table!";
         }
-        return std::nullopt;
+        return nullptr;
     }
 
     auto interface_it = state_it->second.find(interfaceName);
@@ -197,7 +492,7 @@ std::optional<FcmSttTransition> FcmFunctionalComponent::getTransition(const std:
                              name + "\" are not handled!";
         }
 
-        return std::nullopt;
+        return nullptr;
     }
 
     auto message_it = interface_it->second.find(messageName);
@@ -209,10 +504,10 @@ std::optional<FcmSttTransition> FcmFunctionalComponent::getTransition(const std:
                               "\" on interface \"" + interfaceName + "\" in state \"" +
                               stateName + "\" of component \"" + name + "\" is not handled!";
         }
-        return std::nullopt;
+        return nullptr;
     }
 
-    return message_it->second;
+    return &message_it->second;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -221,8 +516,35 @@ int FcmFunctionalComponent::setTimeout(FcmTime timeout)
     return timerHandler.setTimeout(timeout, this);
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+int FcmFunctionalComponent::setTimeout(FcmTimeMicroseconds timeout)
+{
+    return timerHandler.setTimeout(timeout, this);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+int FcmFunctionalComponent::setInterval(FcmTime period)
+{
+    return timerHandler.setInterval(period, this);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+int FcmFunctionalComponent::setInterval(FcmTimeMicroseconds period)
+{
+    return timerHandler.setInterval(period, this);
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 void FcmFunctionalComponent::cancelTimeout(int timerId)
 {
     timerHandler.cancelTimeout(timerId);
+
+    // The timer handler removes the queued timeout messages, deferred ones are removed here.
+    deferredMessages.erase(std::remove_if(deferredMessages.begin(), deferredMessages.end(),
+        [timerId](const std::shared_ptr<FcmMessage>& message)
+        {
+            return message->getInterfaceName() == Timer::interfaceClassName &&
+                   message->getName() == Timer::Timeout::name &&
+                   static_cast<const Timer::Timeout*>(message.get())->timerId == timerId;
+        }), deferredMessages.end());
 }
\ No newline at end of file
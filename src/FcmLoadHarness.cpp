@@ -0,0 +1,450 @@
+#include <cmath>
+#include <random>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "FcmLoadHarness.h"
+#include "FcmDevice.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // -----------------------------------------------------------------------------------------------------------------
+    FCM_SET_INTERFACE(Load,
+        FCM_DEFINE_MESSAGE( Request,
+            int64_t dueTime{};   // Nanoseconds on the steady clock
+            uint32_t hops{};
+        );
+    );
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Shared by the harness, the sources and the components. The latencies and the completion count are only touched
+    // by the device thread.
+    // -----------------------------------------------------------------------------------------------------------------
+    struct LoadContext
+    {
+        explicit LoadContext(const FcmTopologySpec& specParam): spec(specParam) {}
+
+        const FcmTopologySpec& spec;
+        int64_t measureBegin = 0;
+        int64_t measureEnd = 0;
+        std::vector<int64_t> latencies;
+        uint64_t completedInWindow = 0;
+        std::atomic<uint64_t> sentCount{0};
+        std::atomic<int64_t> inFlight{0};
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+    int64_t getTime()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    int64_t sampleCost(const FcmActionCost& cost, std::mt19937_64& random)
+    {
+        double microseconds = cost.mean;
+        switch (cost.distribution)
+        {
+            case FcmActionCost::Distribution::Fixed:
+                break;
+            case FcmActionCost::Distribution::Uniform:
+                microseconds = std::uniform_real_distribution<double>(cost.minimum, cost.maximum)(random);
+                break;
+            case FcmActionCost::Distribution::Exponential:
+                microseconds = cost.mean > 0 ? std::exponential_distribution<double>(1.0 / cost.mean)(random) : 0;
+                break;
+        }
+        return static_cast<int64_t>(microseconds * 1000);
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void spin(int64_t nanoseconds)
+    {
+        if (nanoseconds <= 0)
+        {
+            return;
+        }
+
+        auto end = Clock::now() + std::chrono::nanoseconds(nanoseconds);
+        while (Clock::now() < end) {}
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    FCM_FUNCTIONAL_COMPONENT(LoadComponent,
+    public:
+        std::vector<FcmPort<Load>> downstream;
+        void handleRequest(const Load::Request& request);
+        void handleTimeout();
+    private:
+        LoadContext* context = nullptr;
+        std::mt19937_64 random;
+        size_t nextDownstream = 0;
+        int timerId = -1;
+    );
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void LoadComponent::setStates()
+    {
+        setSetting("loadContext", context);
+        random.seed(context->spec.seed + std::hash<std::string>()(name));
+
+        for (size_t state = 0; state < std::max<size_t>(context->spec.statesPerComponent, 1); state++)
+        {
+            states.push_back("State" + std::to_string(state));
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void LoadComponent::setChoicePoints()
+    {
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void LoadComponent::setTransitions()
+    {
+        for (size_t state = 0; state < states.size(); state++)
+        {
+            addTransitionFunction<Load::Request>(states[state], states[(state + 1) % states.size()],
+            [this](const Load::Request& request)
+            {
+                handleRequest(request);
+            });
+        }
+
+        addTransitionFunction<Timer::Timeout>("*", "H", [this](const Timer::Timeout&)
+        {
+            handleTimeout();
+        });
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void LoadComponent::initialize()
+    {
+        if (context->spec.timerInterval > 0)
+        {
+            timerId = setInterval(context->spec.timerInterval);
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void LoadComponent::handleRequest(const Load::Request& request)
+    {
+        spin(sampleCost(context->spec.actionCost, random));
+
+        if (request.hops + 1 < context->spec.hopCount && !downstream.empty())
+        {
+            auto forwarded = prepareMessage<Load::Request>();
+            forwarded->dueTime = request.dueTime;
+            forwarded->hops = request.hops + 1;
+            downstream[nextDownstream++ % downstream.size()].send(forwarded);
+            return;
+        }
+
+        auto now = getTime();
+        if (request.dueTime >= context->measureBegin && request.dueTime < context->measureEnd)
+        {
+            context->latencies.push_back(now - request.dueTime);
+        }
+
+        // The throughput counts what completed inside the window, a backlog worked off while draining does not count.
+        if (now >= context->measureBegin && now < context->measureEnd)
+        {
+            context->completedInWindow++;
+        }
+        context->inFlight--;
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void LoadComponent::handleTimeout()
+    {
+        spin(sampleCost(context->spec.timerActionCost, random));
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Sends requests at Poisson arrival times from its own thread. A source that falls behind catches up by sending
+    // the overdue requests right away, so the offered load does not depend on the device.
+    // -----------------------------------------------------------------------------------------------------------------
+    FCM_ASYNC_INTERFACE_HANDLER(LoadSource,
+        void start(LoadContext& loadContext, size_t sourceIndex);
+        void join();
+    private:
+        std::thread thread;
+    );
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void LoadSource::initialize()
+    {
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void LoadSource::start(LoadContext& loadContext, size_t sourceIndex)
+    {
+        thread = std::thread([this, &loadContext, sourceIndex]()
+        {
+            const auto& spec = loadContext.spec;
+            std::mt19937_64 random(spec.seed * 7919 + sourceIndex);
+            std::exponential_distribution<double> interval(spec.messageRate / 1e9);
+            std::uniform_int_distribution<size_t> target(0, spec.componentCount - 1);
+
+            auto dueTime = static_cast<double>(getTime());
+            while (true)
+            {
+                dueTime += interval(random);
+                auto due = static_cast<int64_t>(dueTime);
+                if (due >= loadContext.measureEnd)
+                {
+                    return;
+                }
+
+                std::this_thread::sleep_until(Clock::time_point(std::chrono::nanoseconds(due)));
+
+                auto request = prepareMessage<Load::Request>();
+                request->dueTime = due;
+                loadContext.inFlight++;
+                if (due >= loadContext.measureBegin)
+                {
+                    loadContext.sentCount++;
+                }
+                sendMessage(request, target(random));
+            }
+        });
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void LoadSource::join()
+    {
+        if (thread.joinable())
+        {
+            thread.join();
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    class LoadDevice : public FcmDevice
+    {
+    public:
+        std::vector<std::shared_ptr<LoadComponent>> loadComponents;
+        std::vector<std::shared_ptr<LoadSource>> loadSources;
+
+        explicit LoadDevice(LoadContext& contextParam): context(contextParam) {}
+
+        // -------------------------------------------------------------------------------------------------------------
+        void initialize() override
+        {
+            const auto& spec = context.spec;
+            settings["loadContext"] = &context;
+            setSchedulingMode(spec.schedulingMode);
+            setWaitStrategy(spec.waitStrategy);
+
+            for (size_t index = 0; index < spec.componentCount; index++)
+            {
+                loadComponents.push_back(createComponent<LoadComponent>("Component" + std::to_string(index), settings));
+            }
+
+            for (size_t index = 0; index < spec.componentCount; index++)
+            {
+                for (size_t connection = 0; connection < std::min(spec.fanOut, spec.componentCount - 1); connection++)
+                {
+                    auto& remote = loadComponents[(index + 1 + connection) % spec.componentCount];
+                    loadComponents[index]->downstream.push_back(
+                        connectInterface<Load>(loadComponents[index], remote).first);
+                }
+            }
+
+            // The components are on the interface of a source in index order.
+            for (size_t index = 0; index < spec.sourceCount; index++)
+            {
+                auto source = createComponent<LoadSource>("Source" + std::to_string(index), settings);
+                for (const auto& component : loadComponents)
+                {
+                    connectInterface<Load>(source, component);
+                }
+                loadSources.push_back(source);
+            }
+
+            initializeComponents();
+        }
+
+    private:
+        LoadContext& context;
+    };
+
+    // -----------------------------------------------------------------------------------------------------------------
+    int64_t getPercentile(const std::vector<int64_t>& sortedLatencies, double fraction)
+    {
+        if (sortedLatencies.empty())
+        {
+            return 0;
+        }
+
+        auto rank = static_cast<size_t>(std::ceil(fraction * static_cast<double>(sortedLatencies.size())));
+        return sortedLatencies[std::clamp<size_t>(rank, 1, sortedLatencies.size()) - 1] / 1000;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmLoadReport FcmLoadHarness::run(const FcmTopologySpec& spec)
+{
+    if (spec.componentCount == 0 || spec.sourceCount == 0 || spec.messageRate <= 0 || spec.measureTime <= 0)
+    {
+        throw std::runtime_error("Load harness needs components, sources, a message rate and a measure time!");
+    }
+
+    LoadContext context(spec);
+    LoadDevice device(context);
+    device.initialize();
+
+    // Room for the expected number of latencies, so the device thread does not reallocate while measuring.
+    context.latencies.reserve(static_cast<size_t>(
+        spec.messageRate * static_cast<double>(spec.sourceCount * spec.measureTime) / 1000 * 1.2) + 1024);
+
+    int64_t startTime = getTime();
+    context.measureBegin = startTime + spec.warmupTime * 1000000;
+    context.measureEnd = context.measureBegin + spec.measureTime * 1000000;
+
+    std::thread deviceThread([&device]() { device.runUntilStopped(); });
+    for (size_t index = 0; index < device.loadSources.size(); index++)
+    {
+        device.loadSources[index]->start(context, index);
+    }
+
+    for (const auto& source : device.loadSources)
+    {
+        source->join();
+    }
+
+    auto drainDeadline = Clock::now() + std::chrono::milliseconds(spec.drainTimeout);
+    while (context.inFlight.load() > 0 && Clock::now() < drainDeadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    device.stop();
+    deviceThread.join();
+
+    auto& latencies = context.latencies;
+    std::sort(latencies.begin(), latencies.end());
+
+    FcmLoadReport report;
+    double measureSeconds = static_cast<double>(spec.measureTime) / 1000;
+    report.sentCount = context.sentCount.load();
+    report.completedCount = latencies.size();
+    report.offeredRate = static_cast<double>(report.sentCount) / measureSeconds;
+    report.throughput = static_cast<double>(context.completedInWindow) / measureSeconds;
+    report.p50 = getPercentile(latencies, 0.5);
+    report.p99 = getPercentile(latencies, 0.99);
+    report.p999 = getPercentile(latencies, 0.999);
+    report.maxLatency = latencies.empty() ? 0 : latencies.back() / 1000;
+    return report;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::vector<std::string> FcmLoadHarness::check(const FcmLoadReport& report, const FcmLoadThresholds& thresholds)
+{
+    std::vector<std::string> violations;
+
+    auto checkLatency = [&violations](const std::string& latencyName, int64_t latency, int64_t maximum)
+    {
+        if (maximum > 0 && latency > maximum)
+        {
+            violations.push_back(latencyName + " latency " + std::to_string(latency) + " us exceeds " +
+                                 std::to_string(maximum) + " us");
+        }
+    };
+
+    if (thresholds.minThroughput > 0 && report.throughput < thresholds.minThroughput)
+    {
+        violations.push_back("Throughput " + std::to_string(report.throughput) + " msg/s is below " +
+                             std::to_string(thresholds.minThroughput) + " msg/s");
+    }
+    checkLatency("p50", report.p50, thresholds.maxP50);
+    checkLatency("p99", report.p99, thresholds.maxP99);
+    checkLatency("p99.9", report.p999, thresholds.maxP999);
+
+    if (!thresholds.allowIncomplete && report.completedCount < report.sentCount)
+    {
+        violations.push_back(std::to_string(report.sentCount - report.completedCount) + " of " +
+                             std::to_string(report.sentCount) + " messages did not complete");
+    }
+    return violations;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmLoadThresholds FcmLoadThresholds::fromBaseline(const FcmLoadReport& baseline, double tolerance)
+{
+    auto allowLatency = [tolerance](int64_t latency)
+    {
+        return static_cast<int64_t>(std::ceil(static_cast<double>(latency) * (1 + tolerance)));
+    };
+
+    FcmLoadThresholds thresholds;
+    thresholds.minThroughput = baseline.throughput * (1 - tolerance);
+    thresholds.maxP50 = allowLatency(baseline.p50);
+    thresholds.maxP99 = allowLatency(baseline.p99);
+    thresholds.maxP999 = allowLatency(baseline.p999);
+    return thresholds;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::string FcmLoadReport::toString() const
+{
+    std::ostringstream text;
+    text << "sent=" << sentCount << "\n"
+         << "completed=" << completedCount << "\n"
+         << "offeredRate=" << offeredRate << "\n"
+         << "throughput=" << throughput << "\n"
+         << "p50=" << p50 << "\n"
+         << "p99=" << p99 << "\n"
+         << "p999=" << p999 << "\n"
+         << "max=" << maxLatency << "\n";
+    return text.str();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmLoadHarness::saveReport(const FcmLoadReport& report, const std::string& path)
+{
+    std::ofstream file(path, std::ios::trunc);
+    file << report.toString();
+    if (!file)
+    {
+        throw std::runtime_error("Load report \"" + path + "\" cannot be written!");
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmLoadReport FcmLoadHarness::loadReport(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Load report \"" + path + "\" cannot be opened!");
+    }
+
+    FcmLoadReport report;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        auto separator = line.find('=');
+        if (separator == std::string::npos)
+        {
+            continue;
+        }
+
+        auto key = line.substr(0, separator);
+        std::istringstream value(line.substr(separator + 1));
+        if (key == "sent") { value >> report.sentCount; }
+        else if (key == "completed") { value >> report.completedCount; }
+        else if (key == "offeredRate") { value >> report.offeredRate; }
+        else if (key == "throughput") { value >> report.throughput; }
+        else if (key == "p50") { value >> report.p50; }
+        else if (key == "p99") { value >> report.p99; }
+        else if (key == "p999") { value >> report.p999; }
+        else if (key == "max") { value >> report.maxLatency; }
+    }
+    return report;
+}
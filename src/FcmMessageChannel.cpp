@@ -0,0 +1,76 @@
+#include "FcmMessageChannel.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmMessageChannel::FcmMessageChannel(size_t capacity)
+{
+    // Rounded up to a power of two, so positions map to slots with a mask.
+    size_t slotCount = 2;
+    while (slotCount < capacity)
+    {
+        slotCount *= 2;
+    }
+
+    slots = std::make_unique<Slot[]>(slotCount);
+    mask = slotCount - 1;
+    for (size_t slot = 0; slot < slotCount; slot++)
+    {
+        slots[slot].sequence.store(slot, std::memory_order_relaxed);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool FcmMessageChannel::push(const std::shared_ptr<FcmMessage>& message)
+{
+    size_t position = pushPosition.load(std::memory_order_relaxed);
+    Slot* slot;
+    while (true)
+    {
+        slot = &slots[position & mask];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+
+        if (difference == 0)
+        {
+            if (pushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // The slot still holds the message of the previous lap.
+            return false;
+        }
+        else
+        {
+            position = pushPosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->message = message;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool FcmMessageChannel::pop(std::shared_ptr<FcmMessage>& message)
+{
+    size_t position = popPosition.load(std::memory_order_relaxed);
+    auto& slot = slots[position & mask];
+    if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+    {
+        return false;
+    }
+
+    message = std::move(slot.message);
+    slot.sequence.store(position + mask + 1, std::memory_order_release);
+    popPosition.store(position + 1, std::memory_order_relaxed);
+    return true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool FcmMessageChannel::empty() const
+{
+    size_t position = popPosition.load(std::memory_order_relaxed);
+    return slots[position & mask].sequence.load(std::memory_order_acquire) != position + 1;
+}
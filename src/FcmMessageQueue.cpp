@@ -1,45 +1,461 @@
 #include <optional>
 #include <memory>
+#include <thread>
+#include <iterator>
+#include <typeinfo>
+#include <algorithm>
+#include <stdexcept>
 
 #include "FcmMessage.h"
 #include "FcmMessageQueue.h"
+#include "FcmTracer.h"
 
 // ---------------------------------------------------------------------------------------------------------------------
 void FcmMessageQueue::push(const std::shared_ptr<FcmMessage>& message)
+{
+    auto& tracer = FcmTracer::getInstance();
+    if (!tracer.isEnabled())
+    {
+        pushLocked(message);
+        return;
+    }
+
+    auto sendTime = FcmTracer::Clock::now();
+    message->traceId = tracer.newTraceId();
+    pushLocked(message);
+    tracer.traceSend(*message, sendTime, FcmTracer::Clock::now());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::pushRemote(const std::shared_ptr<FcmMessage>& message)
+{
+    auto& tracer = FcmTracer::getInstance();
+    if (!tracer.isEnabled())
+    {
+        pushToChannel(message);
+        return;
+    }
+
+    auto sendTime = FcmTracer::Clock::now();
+    message->traceId = tracer.newTraceId();
+    pushToChannel(message);
+    tracer.traceSend(*message, sendTime, FcmTracer::Clock::now());
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::pushLocked(const std::shared_ptr<FcmMessage>& message)
 {
     std::lock_guard<std::mutex> lock(mutex);
-    
+    enqueue(message);
+
+    // A polling device thread picks up the message without being notified.
+    if (sleepingWaiters.load() > 0)
+    {
+        conditionVariable.notify_one();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::pushToChannel(const std::shared_ptr<FcmMessage>& message)
+{
+    if (!remoteChannel.push(message))
+    {
+        // The device thread is behind, the message is queued under the lock after the ones in the channel.
+        std::lock_guard<std::mutex> lock(mutex);
+        drainRemoteChannel();
+        enqueue(message);
+        if (sleepingWaiters.load() > 0)
+        {
+            conditionVariable.notify_one();
+        }
+        return;
+    }
+
+    // Pairs with the fence in awaitMessage(): either the device thread sees the message before sleeping, or it is
+    // seen sleeping here. Only a sleeping device thread costs taking the lock.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepingWaiters.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        conditionVariable.notify_one();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::enqueue(const std::shared_ptr<FcmMessage>& message)
+{
     message->timestamp =
-            std::chrono::duration_cast<std::chrono::milliseconds>(
-                    std::chrono::system_clock::now().time_since_epoch()).count();
+            std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
 
     queue.push_back(message);
-    conditionVariable.notify_one();
+    if (schedulingMode != FcmSchedulingMode::Fifo)
+    {
+        addToLane(std::prev(queue.end()), false);
+    }
+    pendingCount.store(queue.size(), std::memory_order_release);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::drainRemoteChannel()
+{
+    std::shared_ptr<FcmMessage> message;
+    while (remoteChannel.pop(message))
+    {
+        enqueue(message);
+    }
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 std::shared_ptr<FcmMessage> FcmMessageQueue::awaitMessage()
 {
+    // The device thread returning here means the previous message has been handled.
+    if (schedulingMode == FcmSchedulingMode::WeightedFair && servedLane != nullptr)
+    {
+        chargeServedLane();
+    }
+
+    if (waitStrategy != FcmWaitStrategy::Block)
+    {
+        spinForMessage();
+    }
+
     std::unique_lock<std::mutex> lock(mutex);
-    conditionVariable.wait(lock, [this]() { return !queue.empty(); });
-    auto message = std::move(queue.front());
-    queue.pop_front();
+    sleepingWaiters++;
+    conditionVariable.wait(lock, [this]()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        drainRemoteChannel();
+        return !queue.empty();
+    });
+    sleepingWaiters--;
+
+    auto messageIt = schedulingMode == FcmSchedulingMode::Fifo ? queue.begin() : takeScheduledMessage();
+    auto message = std::move(*messageIt);
+    queue.erase(messageIt);
+    pendingCount.store(queue.size(), std::memory_order_release);
     return message;
 }
 
+// ---------------------------------------------------------------------------------------------------------------------
+size_t FcmMessageQueue::takeRun(const FcmMessage& message,
+                                size_t maxCount,
+                                std::vector<std::shared_ptr<FcmMessage>>& run)
+{
+    auto belongsToRun = [&message](const std::shared_ptr<FcmMessage>& next)
+    {
+        return next->receiver == message.receiver && typeid(*next) == typeid(message) && !next->isStale();
+    };
+
+    std::lock_guard<std::mutex> lock(mutex);
+    drainRemoteChannel();
+
+    size_t taken = 0;
+    if (schedulingMode == FcmSchedulingMode::Fifo)
+    {
+        while (taken < maxCount && !queue.empty() && belongsToRun(queue.front()))
+        {
+            run.push_back(std::move(queue.front()));
+            queue.pop_front();
+            taken++;
+        }
+        pendingCount.store(queue.size(), std::memory_order_release);
+        return taken;
+    }
+
+    // The run is taken from the lane of the receiver, counting against its quota in round-robin mode. In weighted
+    // fair mode the processing time of the whole run is charged when the device thread comes back.
+    auto laneIt = lanes.find(message.receiver);
+    if (laneIt == lanes.end())
+    {
+        return 0;
+    }
+
+    auto& lane = laneIt->second;
+    auto now = Clock::now();
+    while (taken < maxCount && !lane.entries.empty() && belongsToRun(*lane.entries.front().message))
+    {
+        if (schedulingMode == FcmSchedulingMode::RoundRobin && lane.handledInTurn >= lane.quota)
+        {
+            break;
+        }
+
+        auto entry = lane.entries.front();
+        lane.entries.pop_front();
+        lane.handledInTurn++;
+
+        auto waitTime = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::microseconds>(now - entry.enqueueTime).count());
+        lane.statistics.messageCount++;
+        lane.statistics.totalWaitTime += waitTime;
+        lane.statistics.maxWaitTime = std::max(lane.statistics.maxWaitTime, waitTime);
+
+        run.push_back(std::move(*entry.message));
+        queue.erase(entry.message);
+        taken++;
+    }
+    pendingCount.store(queue.size(), std::memory_order_release);
+    return taken;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::spinForMessage() const
+{
+    auto hasMessage = [this]()
+    {
+        return pendingCount.load(std::memory_order_acquire) > 0 || !remoteChannel.empty();
+    };
+
+    if (waitStrategy == FcmWaitStrategy::BusyPoll)
+    {
+        while (!hasMessage()) {}
+        return;
+    }
+
+    for (unsigned int spin = 0; spin < spinCount; spin++)
+    {
+        if (hasMessage()) {return;}
+    }
+
+    for (unsigned int yield = 0; yield < yieldCount; yield++)
+    {
+        if (hasMessage()) {return;}
+        std::this_thread::yield();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::setWaitStrategy(FcmWaitStrategy strategy, unsigned int spins, unsigned int yields)
+{
+    waitStrategy = strategy;
+    spinCount = spins;
+    yieldCount = yields;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::setSchedulingMode(FcmSchedulingMode mode, int64_t quantum)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    schedulingMode = mode;
+    weightedFairQuantum = quantum * 1000;
+    rebuildLanes();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::setReceiverQuota(const void* receiver, unsigned int quota)
+{
+    if (quota == 0)
+    {
+        throw std::runtime_error("Quota of a receiver must be at least 1!");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    lanes[receiver].quota = quota;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::unordered_map<const void*, FcmReceiverStatistics> FcmMessageQueue::getReceiverStatistics() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_map<const void*, FcmReceiverStatistics> statistics;
+    for (const auto& [receiver, lane] : lanes)
+    {
+        statistics[receiver] = lane.statistics;
+    }
+    return statistics;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::removeReceiver(const void* receiver)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    drainRemoteChannel();
+
+    auto laneIt = lanes.find(receiver);
+    if (laneIt == lanes.end())
+    {
+        return;
+    }
+
+    auto& tracer = FcmTracer::getInstance();
+    auto& lane = laneIt->second;
+    for (const auto& entry : lane.entries)
+    {
+        tracer.traceDrop(**entry.message, "released");
+        queue.erase(entry.message);
+    }
+    pendingCount.store(queue.size(), std::memory_order_release);
+
+    if (lane.active)
+    {
+        activeLanes.erase(std::find(activeLanes.begin(), activeLanes.end(), &lane));
+    }
+    if (servedLane == &lane)
+    {
+        servedLane = nullptr;
+    }
+    lanes.erase(laneIt);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::addToLane(QueueIterator message, bool atFront)
+{
+    auto& lane = lanes[(*message)->receiver];
+    LaneEntry entry{message, Clock::now()};
+    if (atFront)
+    {
+        lane.entries.push_front(entry);
+    }
+    else
+    {
+        lane.entries.push_back(entry);
+    }
+
+    if (!lane.active)
+    {
+        lane.active = true;
+        activeLanes.push_back(&lane);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::removeFromLane(QueueIterator message)
+{
+    auto laneIt = lanes.find((*message)->receiver);
+    if (laneIt == lanes.end())
+    {
+        return;
+    }
+
+    // An emptied lane is taken out of the turns by takeScheduledMessage().
+    auto& entries = laneIt->second.entries;
+    for (auto entryIt = entries.begin(); entryIt != entries.end(); ++entryIt)
+    {
+        if (entryIt->message == message)
+        {
+            entries.erase(entryIt);
+            return;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::rebuildLanes()
+{
+    activeLanes.clear();
+    for (auto& [receiver, lane] : lanes)
+    {
+        lane.entries.clear();
+        lane.handledInTurn = 0;
+        lane.deficit = 0;
+        lane.turnStarted = false;
+        lane.active = false;
+    }
+
+    if (schedulingMode == FcmSchedulingMode::Fifo)
+    {
+        return;
+    }
+
+    // The time already spent waiting in the queue is not known here, the wait is counted from now on.
+    for (auto messageIt = queue.begin(); messageIt != queue.end(); ++messageIt)
+    {
+        addToLane(messageIt, false);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::chargeServedLane()
+{
+    // In nanoseconds and at least one, so a receiver cannot keep its turn with messages too cheap to measure.
+    auto processingTime = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - serveTime).count();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    servedLane->deficit -= std::max<int64_t>(processingTime, 1);
+    servedLane = nullptr;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmMessageQueue::QueueIterator FcmMessageQueue::takeScheduledMessage()
+{
+    // Called with a non-empty queue, so there is an active lane with entries.
+    Lane* lane;
+    while (true)
+    {
+        lane = activeLanes.front();
+        if (lane->entries.empty())
+        {
+            activeLanes.pop_front();
+            lane->active = false;
+            lane->turnStarted = false;
+            lane->handledInTurn = 0;
+            lane->deficit = std::min<int64_t>(lane->deficit, 0);
+            continue;
+        }
+
+        if (schedulingMode == FcmSchedulingMode::RoundRobin)
+        {
+            if (lane->handledInTurn < lane->quota)
+            {
+                break;
+            }
+            lane->handledInTurn = 0;
+        }
+        else
+        {
+            // Deficit round robin, each turn adds to the processing time the receiver may use.
+            if (!lane->turnStarted)
+            {
+                lane->deficit += weightedFairQuantum * lane->quota;
+                lane->turnStarted = true;
+            }
+            if (lane->deficit > 0)
+            {
+                break;
+            }
+            lane->turnStarted = false;
+        }
+
+        activeLanes.pop_front();
+        activeLanes.push_back(lane);
+    }
+
+    auto entry = lane->entries.front();
+    lane->entries.pop_front();
+    lane->handledInTurn++;
+
+    auto now = Clock::now();
+    auto waitTime = static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(now - entry.enqueueTime).count());
+    auto& statistics = lane->statistics;
+    statistics.messageCount++;
+    statistics.totalWaitTime += waitTime;
+    statistics.maxWaitTime = std::max(statistics.maxWaitTime, waitTime);
+
+    servedLane = lane;
+    serveTime = now;
+    return entry.message;
+}
+
 // ---------------------------------------------------------------------------------------------------------------------
 bool FcmMessageQueue::removeMessage(const std::string& interfaceName,
                                     const std::string& messageName,
                                     const FcmMessageCheckFunction& checkFunction)
 {
     std::lock_guard<std::mutex> lock(mutex);
+    drainRemoteChannel();
     for (auto it = queue.begin(); it != queue.end(); ++it)
     {
         const auto& message = *it;
         if (message->getInterfaceName() == interfaceName && message->getName() == messageName)
         {
             if (checkFunction && !checkFunction(message)) {continue;}
+            if (schedulingMode != FcmSchedulingMode::Fifo)
+            {
+                removeFromLane(it);
+            }
+            FcmTracer::getInstance().traceDrop(*message, "removed");
             queue.erase(it);
+            pendingCount.store(queue.size(), std::memory_order_release);
             return true;
         }
     }
@@ -47,10 +463,79 @@ bool FcmMessageQueue::removeMessage(const std::string& interfaceName,
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
-void FcmMessageQueue::resendMessage(const std::shared_ptr<FcmMessage>& message)
+size_t FcmMessageQueue::removeMessages(const FcmMessageCheckFunction& checkFunction)
 {
     std::lock_guard<std::mutex> lock(mutex);
-    queue.push_front(message);
+    drainRemoteChannel();
+    size_t removed = 0;
+    for (auto it = queue.begin(); it != queue.end();)
+    {
+        if (checkFunction(*it))
+        {
+            if (schedulingMode != FcmSchedulingMode::Fifo)
+            {
+                removeFromLane(it);
+            }
+            FcmTracer::getInstance().traceDrop(**it, "removed");
+            it = queue.erase(it);
+            removed++;
+            continue;
+        }
+        ++it;
+    }
+    pendingCount.store(queue.size(), std::memory_order_release);
+    return removed;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::vector<std::shared_ptr<FcmMessage>> FcmMessageQueue::getMessages()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    drainRemoteChannel();
+    return {queue.begin(), queue.end()};
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::resendMessage(const std::shared_ptr<FcmMessage>& message)
+{
+    resendMessages({message});
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmMessageQueue::resendMessages(const std::vector<std::shared_ptr<FcmMessage>>& messages)
+{
+    // Their new queue wait gets a new trace-id, see FcmTracer::newTraceId().
+    auto& tracer = FcmTracer::getInstance();
+    bool tracing = tracer.isEnabled();
+    auto sendTime = FcmTracer::Clock::now();
+    for (const auto& message : messages)
+    {
+        message->traceId = tracing ? tracer.newTraceId() : 0;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto firstIt = queue.insert(queue.begin(), messages.begin(), messages.end());
+        if (schedulingMode != FcmSchedulingMode::Fifo)
+        {
+            // Added to the lane fronts last to first, keeping their order.
+            for (auto messageIt = std::next(firstIt, static_cast<long>(messages.size())); messageIt != firstIt;)
+            {
+                --messageIt;
+                addToLane(messageIt, true);
+            }
+        }
+        pendingCount.store(queue.size(), std::memory_order_release);
+    }
+
+    if (tracing)
+    {
+        auto resendTime = FcmTracer::Clock::now();
+        for (const auto& message : messages)
+        {
+            tracer.traceSend(*message, sendTime, resendTime);
+        }
+    }
 }
 
 
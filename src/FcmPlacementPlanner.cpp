@@ -0,0 +1,454 @@
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "FcmPlacementPlanner.h"
+#include "FcmDevice.h"
+
+namespace
+{
+    // -----------------------------------------------------------------------------------------------------------------
+    // Parses a list of CPUs as used in /sys, e.g. "0-3,8,10-11".
+    // -----------------------------------------------------------------------------------------------------------------
+    std::vector<int> parseCpuList(const std::string& cpuList)
+    {
+        std::vector<int> cpus;
+        std::stringstream stream(cpuList);
+        std::string range;
+        while (std::getline(stream, range, ','))
+        {
+            auto dash = range.find('-');
+            try
+            {
+                int first = std::stoi(range.substr(0, dash));
+                int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                for (int cpu = first; cpu <= last; cpu++)
+                {
+                    cpus.push_back(cpu);
+                }
+            }
+            catch (const std::exception&)
+            {
+                return {};
+            }
+        }
+        return cpus;
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    bool readLine(const std::string& path, std::string& line)
+    {
+        std::ifstream file(path);
+        return static_cast<bool>(std::getline(file, line));
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // Lowest CPU sharing the L2 cache of the given CPU, the CPU itself when unknown.
+    // -----------------------------------------------------------------------------------------------------------------
+    int readL2Group(int cpu)
+    {
+        auto cacheDirectory = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+        for (int index = 0; ; index++)
+        {
+            std::string level;
+            if (!readLine(cacheDirectory + std::to_string(index) + "/level", level))
+            {
+                return cpu;
+            }
+
+            std::string sharedCpus;
+            if (level == "2" && readLine(cacheDirectory + std::to_string(index) + "/shared_cpu_list", sharedCpus))
+            {
+                auto cpus = parseCpuList(sharedCpus);
+                return cpus.empty() ? cpu : *std::min_element(cpus.begin(), cpus.end());
+            }
+        }
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // 0 for the same CPU, up to 3 for CPUs on different NUMA nodes.
+    // -----------------------------------------------------------------------------------------------------------------
+    int getDistance(const FcmCpu& first, const FcmCpu& second)
+    {
+        if (first.id == second.id) {return 0;}
+        if (first.l2Group == second.l2Group) {return 1;}
+        if (first.numaNode == second.numaNode) {return 2;}
+        return 3;
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    // A copy of what the plan needs, the component itself may be destroyed once the snapshot is taken.
+    struct PlacedComponent
+    {
+        const FcmBaseComponent* component;  // Only compared, never dereferenced
+        std::string name;
+        size_t currentThread;
+        uint64_t load;
+        std::vector<std::pair<const FcmBaseComponent*, uint64_t>> sentCounts;
+    };
+
+    using TrafficKey = std::pair<size_t, size_t>;
+
+    // -----------------------------------------------------------------------------------------------------------------
+    size_t findCluster(std::vector<size_t>& parents, size_t node)
+    {
+        while (parents[node] != node)
+        {
+            parents[node] = parents[parents[node]];
+            node = parents[node];
+        }
+        return node;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmCpuTopology FcmCpuTopology::detect()
+{
+    std::vector<int> cpuIds;
+#ifdef __linux__
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    if (sched_getaffinity(0, sizeof(cpuSet), &cpuSet) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        {
+            if (CPU_ISSET(cpu, &cpuSet))
+            {
+                cpuIds.push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (cpuIds.empty())
+    {
+        cpuIds.resize(std::max(1u, std::thread::hardware_concurrency()));
+        std::iota(cpuIds.begin(), cpuIds.end(), 0);
+    }
+
+    FcmCpuTopology topology;
+    for (int cpuId : cpuIds)
+    {
+        topology.cpus.push_back(FcmCpu{cpuId, readL2Group(cpuId), 0});
+    }
+
+    // NUMA nodes are numbered from 0, possibly with gaps when nodes are offline.
+    for (int node = 0; node < 1024; node++)
+    {
+        std::string nodeCpus;
+        if (!readLine("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", nodeCpus))
+        {
+            continue;
+        }
+        for (int cpuId : parseCpuList(nodeCpus))
+        {
+            for (auto& cpu : topology.cpus)
+            {
+                if (cpu.id == cpuId)
+                {
+                    cpu.numaNode = node;
+                }
+            }
+        }
+    }
+    return topology;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmPlacementPlan FcmPlacementPlanner::plan(const std::vector<FcmDevice*>& devices,
+                                           size_t threadCount,
+                                           const FcmCpuTopology& topology,
+                                           double imbalance)
+{
+    if (threadCount == 0 || topology.cpus.empty())
+    {
+        throw std::runtime_error("Placement needs at least one thread and one CPU!");
+    }
+
+    // The functional components, each on the thread of its device. The devices may be running: holding the mutex of
+    // a device keeps its components from being released while their counts are copied.
+    std::vector<PlacedComponent> placed;
+    std::unordered_map<const FcmBaseComponent*, size_t> indexOfComponent;
+    for (size_t deviceIndex = 0; deviceIndex < devices.size(); deviceIndex++)
+    {
+        std::lock_guard<std::mutex> lock(devices[deviceIndex]->componentsMutex);
+        for (auto component : devices[deviceIndex]->collectComponents())
+        {
+            if (component->getType() != FcmComponentType::Functional)
+            {
+                continue;
+            }
+
+            PlacedComponent placedComponent{component, component->name, deviceIndex, 1, {}};
+            {
+                std::shared_lock<std::shared_mutex> connectionLock(component->connectionMutex);
+                for (const auto& [receiver, count] : component->sentCounts)
+                {
+                    placedComponent.sentCounts.emplace_back(receiver, count.load(std::memory_order_relaxed));
+                }
+            }
+            indexOfComponent[component] = placed.size();
+            placed.push_back(std::move(placedComponent));
+        }
+    }
+
+    // Traffic between each pair of components. A connection without counted traffic still weighs one message, so
+    // connected components are kept together when nothing has been counted yet.
+    std::map<TrafficKey, uint64_t> traffic;
+    for (size_t index = 0; index < placed.size(); index++)
+    {
+        for (const auto& [receiver, messageCount] : placed[index].sentCounts)
+        {
+            auto receiverIt = indexOfComponent.find(receiver);
+            if (receiverIt == indexOfComponent.end() || receiverIt->second == index)
+            {
+                continue;
+            }
+
+            placed[receiverIt->second].load += messageCount;
+            TrafficKey key = std::minmax(index, receiverIt->second);
+            traffic[key] += std::max<uint64_t>(messageCount, 1);
+        }
+    }
+
+    FcmPlacementPlan placementPlan;
+    uint64_t totalLoad = 0;
+    for (const auto& component : placed)
+    {
+        if (placementPlan.threadOfComponent.count(component.name) != 0)
+        {
+            throw std::runtime_error("Component name \"" + component.name +
+                                     "\" is used more than once, it cannot be placed!");
+        }
+        placementPlan.threadOfComponent[component.name] = 0;
+        totalLoad += component.load;
+    }
+
+    // Clusters: the heaviest connections first, merging components as long as the cluster fits on a thread.
+    auto capacity = static_cast<uint64_t>(static_cast<double>(totalLoad) / threadCount * (1 + imbalance)) + 1;
+    std::vector<std::pair<TrafficKey, uint64_t>> connections(traffic.begin(), traffic.end());
+    std::stable_sort(connections.begin(), connections.end(),
+                     [](const auto& first, const auto& second) { return first.second > second.second; });
+
+    std::vector<size_t> parents(placed.size());
+    std::iota(parents.begin(), parents.end(), 0);
+    std::vector<uint64_t> clusterLoads(placed.size());
+    for (size_t index = 0; index < placed.size(); index++)
+    {
+        clusterLoads[index] = placed[index].load;
+    }
+
+    for (const auto& [key, messageCount] : connections)
+    {
+        auto first = findCluster(parents, key.first);
+        auto second = findCluster(parents, key.second);
+        if (first != second && clusterLoads[first] + clusterLoads[second] <= capacity)
+        {
+            parents[second] = first;
+            clusterLoads[first] += clusterLoads[second];
+        }
+    }
+
+    std::map<size_t, std::vector<size_t>> clusters;
+    for (size_t index = 0; index < placed.size(); index++)
+    {
+        clusters[findCluster(parents, index)].push_back(index);
+    }
+
+    // Threads: the largest clusters first, each to the thread it exchanges most with that still has room, else to
+    // the least loaded thread.
+    std::vector<std::pair<size_t, std::vector<size_t>>> sortedClusters(clusters.begin(), clusters.end());
+    std::stable_sort(sortedClusters.begin(), sortedClusters.end(), [&clusterLoads](const auto& first, const auto& second)
+    {
+        return clusterLoads[first.first] > clusterLoads[second.first];
+    });
+
+    std::vector<size_t> threadOf(placed.size(), threadCount);
+    std::vector<uint64_t> threadLoads(threadCount);
+    for (const auto& [root, members] : sortedClusters)
+    {
+        std::vector<uint64_t> affinity(threadCount);
+        for (auto member : members)
+        {
+            for (const auto& [key, messageCount] : traffic)
+            {
+                auto other = key.first == member ? key.second : key.second == member ? key.first : member;
+                if (other != member && threadOf[other] < threadCount)
+                {
+                    affinity[threadOf[other]] += messageCount;
+                }
+            }
+        }
+
+        size_t chosen = std::min_element(threadLoads.begin(), threadLoads.end()) - threadLoads.begin();
+        for (size_t thread = 0; thread < threadCount; thread++)
+        {
+            if (threadLoads[thread] + clusterLoads[root] <= capacity && affinity[thread] > affinity[chosen])
+            {
+                chosen = thread;
+            }
+        }
+
+        threadLoads[chosen] += clusterLoads[root];
+        for (auto member : members)
+        {
+            threadOf[member] = chosen;
+        }
+    }
+
+    // Traffic between the threads, to place the threads exchanging most on CPUs close to each other.
+    std::map<TrafficKey, uint64_t> threadTraffic;
+    for (const auto& [key, messageCount] : traffic)
+    {
+        auto firstThread = threadOf[key.first];
+        auto secondThread = threadOf[key.second];
+        if (firstThread != secondThread)
+        {
+            threadTraffic[std::minmax(firstThread, secondThread)] += messageCount;
+        }
+    }
+
+    auto getThreadTraffic = [&threadTraffic](size_t first, size_t second) -> uint64_t
+    {
+        auto trafficIt = threadTraffic.find(std::minmax(first, second));
+        return trafficIt == threadTraffic.end() ? 0 : trafficIt->second;
+    };
+
+    // CPUs: the busiest thread first, then each time the thread exchanging most with the placed ones, on the free CPU
+    // closest to them. When there are more threads than CPUs, CPUs are shared.
+    std::vector<size_t> cpuOf(threadCount, topology.cpus.size());
+    std::vector<bool> cpuUsed(topology.cpus.size());
+    std::vector<size_t> placedThreads;
+    while (placedThreads.size() < threadCount)
+    {
+        size_t nextThread = threadCount;
+        uint64_t bestTraffic = 0;
+        for (size_t thread = 0; thread < threadCount; thread++)
+        {
+            if (cpuOf[thread] != topology.cpus.size())
+            {
+                continue;
+            }
+
+            uint64_t exchanged = 0;
+            for (auto placedThread : placedThreads)
+            {
+                exchanged += getThreadTraffic(thread, placedThread);
+            }
+            if (nextThread == threadCount || exchanged > bestTraffic ||
+                (exchanged == bestTraffic && threadLoads[thread] > threadLoads[nextThread]))
+            {
+                nextThread = thread;
+                bestTraffic = exchanged;
+            }
+        }
+
+        bool freeCpu = std::find(cpuUsed.begin(), cpuUsed.end(), false) != cpuUsed.end();
+        size_t bestCpu = topology.cpus.size();
+        uint64_t bestCost = 0;
+        for (size_t cpu = 0; cpu < topology.cpus.size(); cpu++)
+        {
+            if (freeCpu && cpuUsed[cpu])
+            {
+                continue;
+            }
+
+            uint64_t cost = 0;
+            for (auto placedThread : placedThreads)
+            {
+                cost += getThreadTraffic(nextThread, placedThread) *
+                        getDistance(topology.cpus[cpu], topology.cpus[cpuOf[placedThread]]);
+            }
+            if (bestCpu == topology.cpus.size() || cost < bestCost)
+            {
+                bestCpu = cpu;
+                bestCost = cost;
+            }
+        }
+
+        cpuOf[nextThread] = bestCpu;
+        cpuUsed[bestCpu] = true;
+        placedThreads.push_back(nextThread);
+    }
+
+    // The plan and what it saves.
+    placementPlan.threads.resize(threadCount);
+    for (size_t thread = 0; thread < threadCount; thread++)
+    {
+        const auto& cpu = topology.cpus[cpuOf[thread]];
+        placementPlan.threads[thread].cpu = cpu.id;
+        placementPlan.threads[thread].numaNode = cpu.numaNode;
+        placementPlan.threads[thread].load = threadLoads[thread];
+    }
+    for (size_t index = 0; index < placed.size(); index++)
+    {
+        const auto& name = placed[index].name;
+        placementPlan.threads[threadOf[index]].componentNames.push_back(name);
+        placementPlan.threadOfComponent[name] = threadOf[index];
+    }
+
+    for (const auto& [key, messageCount] : traffic)
+    {
+        placementPlan.totalTraffic += messageCount;
+        if (placed[key.first].currentThread != placed[key.second].currentThread)
+        {
+            placementPlan.currentCrossThreadTraffic += messageCount;
+        }
+
+        auto firstThread = threadOf[key.first];
+        auto secondThread = threadOf[key.second];
+        if (firstThread == secondThread)
+        {
+            continue;
+        }
+
+        placementPlan.plannedCrossThreadTraffic += messageCount;
+        auto distance = getDistance(topology.cpus[cpuOf[firstThread]], topology.cpus[cpuOf[secondThread]]);
+        if (distance >= 2)
+        {
+            placementPlan.plannedCrossL2Traffic += messageCount;
+        }
+        if (distance >= 3)
+        {
+            placementPlan.plannedCrossNumaTraffic += messageCount;
+        }
+    }
+
+    return placementPlan;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::string FcmPlacementPlan::toString() const
+{
+    auto percentage = [this](uint64_t messageCount)
+    {
+        return totalTraffic == 0 ? 0 : messageCount * 100 / totalTraffic;
+    };
+
+    std::ostringstream text;
+    text << "traffic=" << totalTraffic << "\n"
+         << "currentCrossThread=" << currentCrossThreadTraffic << " (" << percentage(currentCrossThreadTraffic) << "%)\n"
+         << "plannedCrossThread=" << plannedCrossThreadTraffic << " (" << percentage(plannedCrossThreadTraffic) << "%)\n"
+         << "plannedCrossL2=" << plannedCrossL2Traffic << " (" << percentage(plannedCrossL2Traffic) << "%)\n"
+         << "plannedCrossNuma=" << plannedCrossNumaTraffic << " (" << percentage(plannedCrossNumaTraffic) << "%)\n";
+
+    for (size_t thread = 0; thread < threads.size(); thread++)
+    {
+        const auto& placementThread = threads[thread];
+        text << "thread " << thread << ": cpu=" << placementThread.cpu << " node=" << placementThread.numaNode
+             << " load=" << placementThread.load << " components=";
+        for (size_t index = 0; index < placementThread.componentNames.size(); index++)
+        {
+            text << (index == 0 ? "" : ",") << placementThread.componentNames[index];
+        }
+        text << "\n";
+    }
+    return text.str();
+}
@@ -0,0 +1,98 @@
+#include <stdexcept>
+
+#include "FcmSettingsSchema.h"
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmSettingsSchema::addEntry(const std::string& name,
+                                 std::type_index type,
+                                 std::shared_ptr<const void> defaultValue,
+                                 ValueFunction makeValueFunction)
+{
+    if (slots.find(name) != slots.end())
+    {
+        throw std::runtime_error("Setting \"" + name + "\" is already in the schema!");
+    }
+
+    slots[name] = entries.size();
+    entries.push_back(Entry{name, type, std::move(defaultValue), std::move(makeValueFunction)});
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::shared_ptr<const void> FcmSettingsSchema::makeValue(const Entry& entry, const std::any& value) const
+{
+    if (std::type_index(value.type()) != entry.type)
+    {
+        throw std::runtime_error("Setting \"" + entry.name + "\" has the wrong type!");
+    }
+    return entry.makeValue(value);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::shared_ptr<const FcmSettingsSnapshot> FcmSettingsSchema::createSnapshot(const FcmSettings& values) const
+{
+    auto snapshot = std::make_shared<FcmSettingsSnapshot>();
+    for (const auto& entry : entries)
+    {
+        auto valueIt = values.find(entry.name);
+        snapshot->values.push_back(valueIt == values.end() ? entry.defaultValue : makeValue(entry, valueIt->second));
+    }
+    return snapshot;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::shared_ptr<const FcmSettingsSnapshot> FcmSettingsSchema::updateSnapshot(const FcmSettingsSnapshot& base,
+                                                                           const FcmSettings& changes) const
+{
+    auto snapshot = std::make_shared<FcmSettingsSnapshot>(base);
+    snapshot->version = base.version + 1;
+    for (const auto& [name, value] : changes)
+    {
+        auto slotIt = slots.find(name);
+        if (slotIt == slots.end())
+        {
+            throw std::runtime_error("Setting \"" + name + "\" is not in the schema!");
+        }
+        snapshot->values[slotIt->second] = makeValue(entries[slotIt->second], value);
+    }
+    return snapshot;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmSettingsStore::FcmSettingsStore(const FcmSettingsSchema& schemaParam, const FcmSettings& values) :
+    schema(schemaParam),
+    currentOwner(schema.createSnapshot(values)),
+    deviceSnapshot(currentOwner.get())
+{
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::shared_ptr<const FcmSettingsSnapshot> FcmSettingsStore::acquire() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return currentOwner;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmSettingsStore::update(const FcmSettings& changes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto snapshot = schema.updateSnapshot(*currentOwner, changes);
+
+    // The device thread may still be reading the replaced snapshot until its next quiescent state.
+    retired.push_back(std::move(currentOwner));
+    currentOwner = std::move(snapshot);
+    retiredPending.store(true, std::memory_order_release);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmSettingsStore::releaseRetired()
+{
+    // Freed outside the lock, after the device thread has moved on to the current snapshot.
+    std::vector<std::shared_ptr<const FcmSettingsSnapshot>> released;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        deviceSnapshot = currentOwner.get();
+        released.swap(retired);
+        retiredPending.store(false, std::memory_order_relaxed);
+    }
+}
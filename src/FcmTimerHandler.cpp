@@ -1,27 +1,195 @@
+#include <algorithm>
+#include <stdexcept>
+
 #include "FcmTimerHandler.h"
 #include "FcmFunctionalComponent.h"
 #include "FcmMessageQueue.h"
+#include "FcmTracer.h"
 
 // ---------------------------------------------------------------------------------------------------------------------
 int FcmTimerHandler::setTimeout(FcmTime timeout, void* component)
 {
+    return setTimeout(std::chrono::milliseconds(timeout), component);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+int FcmTimerHandler::setTimeout(FcmTimeMicroseconds timeout, void* component)
+{
+    std::lock_guard<std::mutex> lock(mutex);
     int timerId = nextTimerId++;
+    armTimeout(timerId, timeout, FcmTimeMicroseconds::zero(), component);
+    return timerId;
+}
 
+// ---------------------------------------------------------------------------------------------------------------------
+int FcmTimerHandler::setInterval(FcmTime period, void* component)
+{
+    return setInterval(std::chrono::milliseconds(period), component);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+int FcmTimerHandler::setInterval(FcmTimeMicroseconds period, void* component)
+{
+    if (period <= FcmTimeMicroseconds::zero())
+    {
+        throw std::runtime_error("Interval period must be positive!");
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    int timerId = nextTimerId++;
+    armTimeout(timerId, period, period, component);
+    return timerId;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTimerHandler::restoreTimeout(int timerId,
+                                     FcmTimeMicroseconds remaining,
+                                     FcmTimeMicroseconds period,
+                                     void* component)
+{
     std::lock_guard<std::mutex> lock(mutex);
-    timeouts.emplace(std::make_pair(timerId, FcmTimerInfo{component, false}));
+    nextTimerId = std::max(nextTimerId, timerId + 1);
+    armTimeout(timerId, remaining, period, component);
+
+    // Timeout messages of it may have been restored along with the queue.
+    timeouts[timerId].fired = true;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTimerHandler::armTimeout(int timerId, FcmTimeMicroseconds timeout, FcmTimeMicroseconds period, void* component)
+{
+    // Re-arming leaves the previous entry behind, counted as dead from the next purge on.
+    purgeExpiries();
 
-    std::thread([this, timerId, timeout]() 
+    // The generation tells the timer thread whether a heap entry still belongs to the armed timeout.
+    uint64_t generation = nextGeneration++;
+    auto expiry = Clock::now() + timeout;
+    timeouts[timerId] = FcmTimerInfo{component, period, expiry, generation};
+    componentTimeouts.emplace(component, timerId);
+
+    // Only an expiry earlier than all others changes what the timer thread waits for.
+    bool earliest = expiries.empty() || expiry < expiries.top().expiry;
+    expiries.push(ScheduledExpiry{expiry, timerId, generation});
+
+    if (!timerThread.joinable())
+    {
+        timerThread = std::thread(&FcmTimerHandler::runTimerThread, this);
+    }
+    else if (earliest)
+    {
+        wakeCondition.notify_one();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmTimerHandler::~FcmTimerHandler()
+{
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
         std::lock_guard<std::mutex> lock(mutex);
-        if (!timeouts[timerId].cancelled)
+        stopping = true;
+    }
+    wakeCondition.notify_one();
+
+    if (timerThread.joinable())
+    {
+        timerThread.join();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTimerHandler::runTimerThread()
+{
+    FcmTracer::getInstance().nameThread("Timer");
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping)
+    {
+        if (expiries.empty())
         {
-            sendTimeoutMessage(timerId, timeouts[timerId].component);
+            wakeCondition.wait(lock);
+            continue;
         }
-        timeouts.erase(timerId);
-    }).detach();
 
-    return timerId;
+        auto scheduledExpiry = expiries.top();
+        if (wakeCondition.wait_until(lock, scheduledExpiry.expiry) != std::cv_status::timeout)
+        {
+            // Woken up for an earlier expiry or to stop, or spuriously.
+            continue;
+        }
+
+        // Expire everything that is due, an earlier expiry may have been set while waiting.
+        auto now = Clock::now();
+        while (!expiries.empty() && expiries.top().expiry <= now)
+        {
+            scheduledExpiry = expiries.top();
+            expiries.pop();
+            expireTimeout(scheduledExpiry, now);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTimerHandler::expireTimeout(const ScheduledExpiry& scheduledExpiry, Clock::time_point now)
+{
+    // Entries of cancelled or re-armed timeouts are left in the heap and skipped here.
+    auto timeoutIt = timeouts.find(scheduledExpiry.timerId);
+    if (timeoutIt == timeouts.end() || timeoutIt->second.generation != scheduledExpiry.generation)
+    {
+        return;
+    }
+
+    auto& timerInfo = timeoutIt->second;
+    sendTimeoutMessage(scheduledExpiry.timerId, timerInfo.component);
+
+    if (timerInfo.period == FcmTimeMicroseconds::zero())
+    {
+        eraseTimeout(scheduledExpiry.timerId, timerInfo.component);
+        return;
+    }
+
+    // The next expiry follows from the previous one, skipping the ones already missed.
+    timerInfo.fired = true;
+    timerInfo.expiry += timerInfo.period;
+    if (timerInfo.expiry <= now)
+    {
+        auto missedPeriods = (now - timerInfo.expiry) / timerInfo.period + 1;
+        timerInfo.expiry += missedPeriods * timerInfo.period;
+    }
+    expiries.push(ScheduledExpiry{timerInfo.expiry, scheduledExpiry.timerId, scheduledExpiry.generation});
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTimerHandler::eraseTimeout(int timerId, void* component)
+{
+    timeouts.erase(timerId);
+
+    auto range = componentTimeouts.equal_range(component);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == timerId)
+        {
+            componentTimeouts.erase(it);
+            break;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTimerHandler::purgeExpiries()
+{
+    // Each armed timeout has exactly one entry in the heap, the others belong to cancelled or re-armed ones.
+    if (expiries.size() <= 2 * timeouts.size())
+    {
+        return;
+    }
+
+    std::vector<ScheduledExpiry> liveExpiries;
+    liveExpiries.reserve(timeouts.size());
+    for (const auto& [timerId, timerInfo] : timeouts)
+    {
+        liveExpiries.push_back(ScheduledExpiry{timerInfo.expiry, timerId, timerInfo.generation});
+    }
+    expiries = decltype(expiries)(std::greater<>(), std::move(liveExpiries));
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
@@ -36,24 +204,67 @@ void FcmTimerHandler::sendTimeoutMessage(int timerId, void* component)
 // ---------------------------------------------------------------------------------------------------------------------
 void FcmTimerHandler::cancelTimeout(int timerId)
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    if (timeouts.find(timerId) != timeouts.end())
+    // Timeout messages are sent while holding the lock, so once the timeout is erased none can be queued after the ones
+    // removed below. The queue is searched outside the lock, so that the timer thread is not held up by it.
+    bool fired = true;
     {
-        timeouts[timerId].cancelled = true;
-        return;
+        std::lock_guard<std::mutex> lock(mutex);
+        auto timeoutIt = timeouts.find(timerId);
+        if (timeoutIt != timeouts.end())
+        {
+            fired = timeoutIt->second.fired;
+            eraseTimeout(timerId, timeoutIt->second.component);
+            purgeExpiries();
+        }
     }
 
-    removeTimeoutMessage(timerId);
+    // A one-shot timeout that fired is no longer armed, one that never fired has nothing queued.
+    if (fired)
+    {
+        removeTimeoutMessages(timerId);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTimerHandler::cancelComponentTimeouts(void* component)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto range = componentTimeouts.equal_range(component);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        timeouts.erase(it->second);
+    }
+    componentTimeouts.erase(component);
+    purgeExpiries();
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
-bool FcmTimerHandler::removeTimeoutMessage(int timerId)
+std::vector<FcmArmedTimeout> FcmTimerHandler::getArmedTimeouts()
 {
-    auto checkFunction = [timerId](const std::shared_ptr<FcmMessage>& msg) -> bool
+    std::lock_guard<std::mutex> lock(mutex);
+    auto now = Clock::now();
+
+    std::vector<FcmArmedTimeout> armedTimeouts;
+    for (const auto& [timerId, timerInfo] : timeouts)
     {
-        auto timeoutMessage = static_cast<const Timer::Timeout*>(msg.get());
-        return timeoutMessage && timeoutMessage->timerId != timerId;
-    };
+        auto remaining = std::chrono::duration_cast<FcmTimeMicroseconds>(timerInfo.expiry - now);
+        armedTimeouts.push_back(FcmArmedTimeout{timerId,
+                                                timerInfo.component,
+                                                std::max(remaining, FcmTimeMicroseconds::zero()),
+                                                timerInfo.period});
+    }
+    return armedTimeouts;
+}
 
-    return messageQueue.removeMessage("Timer", "Timeout", checkFunction);
-}
\ No newline at end of file
+// ---------------------------------------------------------------------------------------------------------------------
+size_t FcmTimerHandler::removeTimeoutMessages(int timerId)
+{
+    return messageQueue.removeMessages([timerId](const std::shared_ptr<FcmMessage>& msg) -> bool
+    {
+        if (msg->getInterfaceName() != Timer::interfaceClassName || msg->getName() != Timer::Timeout::name)
+        {
+            return false;
+        }
+        return static_cast<const Timer::Timeout*>(msg.get())->timerId == timerId;
+    });
+}
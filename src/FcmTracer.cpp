@@ -0,0 +1,269 @@
+#include <cstdio>
+#include <stdexcept>
+
+#include "FcmTracer.h"
+#include "FcmBaseComponent.h"
+
+namespace
+{
+    const size_t flushThreshold = 64 * 1024;
+
+    // -----------------------------------------------------------------------------------------------------------------
+    std::string getComponentName(const void* component)
+    {
+        return component != nullptr ? static_cast<const FcmBaseComponent*>(component)->name : std::string();
+    }
+
+    // -----------------------------------------------------------------------------------------------------------------
+    std::string getTraceId(uint64_t traceId)
+    {
+        char text[24];
+        std::snprintf(text, sizeof(text), "\"0x%llx\"", static_cast<unsigned long long>(traceId));
+        return text;
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTracer::start(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (enabled.load(std::memory_order_relaxed))
+    {
+        throw std::runtime_error("Trace \"" + path + "\" cannot be started, already tracing!");
+    }
+
+    file.open(path, std::ios::out | std::ios::trunc);
+    if (!file)
+    {
+        throw std::runtime_error("Trace \"" + path + "\" cannot be opened!");
+    }
+
+    buffer = "[\n";
+    firstEvent = true;
+    origin = Clock::now();
+    for (const auto& [threadId, threadName] : threadNames)
+    {
+        writeThreadName(threadId, threadName);
+    }
+    enabled.store(true, std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTracer::stop()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    enabled.store(false, std::memory_order_relaxed);
+    buffer += "\n]\n";
+    flush();
+    file.close();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTracer::nameThread(const std::string& threadName)
+{
+    int threadId = getThreadId();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    threadNames[threadId] = threadName;
+    if (enabled.load(std::memory_order_relaxed))
+    {
+        writeThreadName(threadId, threadName);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTracer::traceSend(const FcmMessage& message, Clock::time_point begin, Clock::time_point end)
+{
+    auto messageName = escape(message.getInterfaceName() + ":" + message.getName());
+    auto traceId = getTraceId(message.traceId);
+    auto senderName = escape(getComponentName(message.sender));
+    auto receiverName = escape(getComponentName(message.receiver));
+    auto threadId = std::to_string(getThreadId());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    writeEvent("{\"name\":\"send " + messageName + "\",\"cat\":\"message\",\"ph\":\"X\","
+               "\"ts\":" + getTimestamp(begin) + ",\"dur\":" + getDuration(begin, end) + ","
+               "\"pid\":1,\"tid\":" + threadId + ",\"bind_id\":" + traceId + ",\"flow_out\":true,"
+               "\"args\":{\"from\":\"" + senderName + "\",\"to\":\"" + receiverName + "\"}}");
+
+    writeEvent("{\"name\":\"" + messageName + "\",\"cat\":\"queue\",\"ph\":\"b\","
+               "\"ts\":" + getTimestamp(end) + ",\"pid\":1,\"id\":" + traceId + ","
+               "\"args\":{\"to\":\"" + receiverName + "\"}}");
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTracer::traceDispatch(const FcmMessage& message,
+                              const void* receiver,
+                              const std::string& state,
+                              const std::string& nextState,
+                              Clock::time_point begin,
+                              Clock::time_point end)
+{
+    auto messageName = escape(message.getInterfaceName() + ":" + message.getName());
+    auto receiverName = escape(getComponentName(receiver));
+    auto threadId = std::to_string(getThreadId());
+
+    // Messages queued before tracing started have no trace-id, so there is nothing to connect.
+    std::string flow;
+    std::string traceId;
+    if (message.traceId != 0)
+    {
+        traceId = getTraceId(message.traceId);
+        flow = ",\"bind_id\":" + traceId + ",\"flow_in\":true";
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    if (message.traceId != 0)
+    {
+        writeEvent("{\"name\":\"" + messageName + "\",\"cat\":\"queue\",\"ph\":\"e\","
+                   "\"ts\":" + getTimestamp(begin) + ",\"pid\":1,\"id\":" + traceId + "}");
+    }
+
+    writeEvent("{\"name\":\"" + messageName + "\",\"cat\":\"message\",\"ph\":\"X\","
+               "\"ts\":" + getTimestamp(begin) + ",\"dur\":" + getDuration(begin, end) + ","
+               "\"pid\":1,\"tid\":" + threadId + flow + ","
+               "\"args\":{\"component\":\"" + receiverName + "\",\"state\":\"" + escape(state) + "\","
+               "\"nextState\":\"" + escape(nextState) + "\"}}");
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTracer::traceDrop(const FcmMessage& message, const std::string& reason)
+{
+    // Messages queued before tracing started have no trace-id, their queue wait never began.
+    if (message.traceId == 0)
+    {
+        return;
+    }
+
+    auto dropTime = Clock::now();
+    auto messageName = escape(message.getInterfaceName() + ":" + message.getName());
+    auto traceId = getTraceId(message.traceId);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    writeEvent("{\"name\":\"" + messageName + "\",\"cat\":\"queue\",\"ph\":\"e\","
+               "\"ts\":" + getTimestamp(dropTime) + ",\"pid\":1,\"id\":" + traceId + ","
+               "\"args\":{\"dropped\":\"" + escape(reason) + "\"}}");
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTracer::traceSlice(const std::string& sliceName,
+                           const std::string& category,
+                           Clock::time_point begin,
+                           Clock::time_point end)
+{
+    auto threadId = std::to_string(getThreadId());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+
+    writeEvent("{\"name\":\"" + escape(sliceName) + "\",\"cat\":\"" + escape(category) + "\",\"ph\":\"X\","
+               "\"ts\":" + getTimestamp(begin) + ",\"dur\":" + getDuration(begin, end) + ","
+               "\"pid\":1,\"tid\":" + threadId + "}");
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTracer::writeEvent(const std::string& event)
+{
+    if (!firstEvent)
+    {
+        buffer += ",\n";
+    }
+    buffer += event;
+    firstEvent = false;
+
+    if (buffer.size() >= flushThreshold)
+    {
+        flush();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTracer::writeThreadName(int threadId, const std::string& threadName)
+{
+    writeEvent("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(threadId) + ","
+               "\"args\":{\"name\":\"" + escape(threadName) + "\"}}");
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmTracer::flush()
+{
+    file.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    file.flush();
+    buffer.clear();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::string FcmTracer::getTimestamp(Clock::time_point time) const
+{
+    return getDuration(origin, time);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::string FcmTracer::getDuration(Clock::time_point begin, Clock::time_point end)
+{
+    // Trace event times are in microseconds.
+    char text[32];
+    auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    std::snprintf(text, sizeof(text), "%.3f", static_cast<double>(nanoseconds) / 1000.0);
+    return text;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+int FcmTracer::getThreadId()
+{
+    static std::atomic<int> nextThreadId{1};
+    thread_local int threadId = nextThreadId.fetch_add(1, std::memory_order_relaxed);
+    return threadId;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::string FcmTracer::escape(const std::string& text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char character : text)
+    {
+        switch (character)
+        {
+            case '"':  escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\t': escaped += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(character) < 0x20)
+                {
+                    char code[8];
+                    std::snprintf(code, sizeof(code), "\\u%04x", character);
+                    escaped += code;
+                }
+                else
+                {
+                    escaped += character;
+                }
+        }
+    }
+    return escaped;
+}
@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__linux__) && defined(__GLIBC__)
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <pthread.h>
+#include <execinfo.h>
+#define FCM_WATCHDOG_STACK_SAMPLES
+#endif
+
+#include "FcmWatchdog.h"
+#include "FcmBaseComponent.h"
+
+#ifdef FCM_WATCHDOG_STACK_SAMPLES
+namespace
+{
+    // The device thread is interrupted with the sample signal and records its own stack.
+    const int defaultSampleSignal = SIGUSR2;
+    const int maxStackDepth = 64;
+
+    void* stackFrames[maxStackDepth];
+    std::atomic<int> stackDepth{-1};
+    std::atomic<bool> samplePending{false};
+    std::mutex samplingMutex;
+
+    // The handler is process-wide: the first watchdog installs it, the last one restores the previous handler. Guarded
+    // by samplingMutex.
+    int installedSignal = 0;
+    int installCount = 0;
+    struct sigaction previousAction{};
+
+    // -----------------------------------------------------------------------------------------------------------------
+    void recordStack(int signal, siginfo_t* info, void* context)
+    {
+        int savedErrno = errno;
+        if (samplePending.exchange(false, std::memory_order_acq_rel))
+        {
+            stackDepth.store(backtrace(stackFrames, maxStackDepth), std::memory_order_release);
+        }
+        else if ((previousAction.sa_flags & SA_SIGINFO) != 0)
+        {
+            previousAction.sa_sigaction(signal, info, context);
+        }
+        else if (previousAction.sa_handler != SIG_DFL && previousAction.sa_handler != SIG_IGN)
+        {
+            previousAction.sa_handler(signal);
+        }
+        errno = savedErrno;
+    }
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmWatchdog::FcmWatchdog(int64_t budgetParam,
+                         FcmWatchdogReportFunction reportFunctionParam,
+                         size_t topCountParam,
+                         bool captureStackParam,
+                         int sampleSignalParam):
+    budget(budgetParam),
+    reportFunction(std::move(reportFunctionParam)),
+    topCount(topCountParam),
+    captureStack(captureStackParam),
+    sampleSignal(sampleSignalParam)
+{
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmWatchdog::~FcmWatchdog()
+{
+    {
+        std::lock_guard<std::mutex> lock(stopMutex);
+        stopRequested = true;
+    }
+    stopCondition.notify_one();
+
+    if (watchThread.joinable())
+    {
+        watchThread.join();
+    }
+
+    // No sample is requested once the watch thread has stopped.
+    restoreSignalHandler();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmWatchdog::start()
+{
+    if (watchThread.joinable())
+    {
+        return;
+    }
+
+#ifdef FCM_WATCHDOG_STACK_SAMPLES
+    if (captureStack)
+    {
+        deviceThread = pthread_self();
+
+        // The first backtrace() loads the unwinder, which must not happen inside the signal handler.
+        void* frame;
+        backtrace(&frame, 1);
+
+        installSignalHandler();
+    }
+#endif
+
+    watchThread = std::thread(&FcmWatchdog::watch, this);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmWatchdog::installSignalHandler()
+{
+#ifdef FCM_WATCHDOG_STACK_SAMPLES
+    int signal = sampleSignal != 0 ? sampleSignal : defaultSampleSignal;
+
+    std::lock_guard<std::mutex> lock(samplingMutex);
+    if (installCount > 0)
+    {
+        if (signal != installedSignal)
+        {
+            throw std::runtime_error("Watchdog cannot sample stacks with signal " + std::to_string(signal) +
+                                     ", another watchdog uses signal " + std::to_string(installedSignal) + "!");
+        }
+        installCount++;
+        signalHandlerInstalled = true;
+        return;
+    }
+
+    struct sigaction action{};
+    action.sa_sigaction = recordStack;
+    action.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(signal, &action, &previousAction) != 0)
+    {
+        throw std::runtime_error("Watchdog cannot install a handler for signal " + std::to_string(signal) + "!");
+    }
+    installedSignal = signal;
+    installCount = 1;
+    signalHandlerInstalled = true;
+#endif
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmWatchdog::restoreSignalHandler()
+{
+#ifdef FCM_WATCHDOG_STACK_SAMPLES
+    if (!signalHandlerInstalled)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(samplingMutex);
+    signalHandlerInstalled = false;
+    if (--installCount == 0)
+    {
+        sigaction(installedSignal, &previousAction, nullptr);
+        installedSignal = 0;
+    }
+#endif
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmWatchdog::begin(FcmActivityType type,
+                        const FcmBaseComponent* component,
+                        const std::string& state,
+                        const std::string& interfaceName,
+                        const std::string& messageName)
+{
+    std::lock_guard<std::mutex> lock(activityMutex);
+    activity.type = type;
+    activity.component = component;
+    activity.state = &state;
+    activity.interfaceName = &interfaceName;
+    activity.messageName = &messageName;
+    activity.startTime = Clock::now();
+    activity.active = true;
+    activity.reported = false;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmWatchdog::end()
+{
+    auto endTime = Clock::now();
+
+    Activity finishedActivity;
+    {
+        std::lock_guard<std::mutex> lock(activityMutex);
+        finishedActivity = activity;
+        activity.active = false;
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(endTime - finishedActivity.startTime).count();
+
+    if (elapsed > slowestThreshold.load(std::memory_order_relaxed))
+    {
+        updateSlowestTransitions(finishedActivity, elapsed);
+    }
+
+    // Also reported when the watchdog thread did not get to it while it was running.
+    if (elapsed > budget)
+    {
+        auto report = makeReport(finishedActivity, elapsed);
+        report.finished = true;
+        reportFunction(report);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::vector<FcmSlowTransition> FcmWatchdog::getSlowestTransitions()
+{
+    std::lock_guard<std::mutex> lock(slowestMutex);
+    return slowestTransitions;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmWatchdog::watch()
+{
+    auto checkInterval = std::chrono::microseconds(std::max<int64_t>(budget / 2, 1000));
+
+    std::unique_lock<std::mutex> stopLock(stopMutex);
+    while (!stopCondition.wait_for(stopLock, checkInterval, [this]() { return stopRequested; }))
+    {
+        stopLock.unlock();
+
+        FcmWatchdogReport report;
+        bool overrun = false;
+        {
+            std::lock_guard<std::mutex> lock(activityMutex);
+            if (activity.active && !activity.reported)
+            {
+                auto elapsed =
+                    std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - activity.startTime).count();
+                if (elapsed > budget)
+                {
+                    activity.reported = true;
+                    report = makeReport(activity, elapsed);
+                    overrun = true;
+                }
+            }
+        }
+
+        if (overrun)
+        {
+            if (captureStack)
+            {
+                report.stackSample = sampleStack();
+            }
+            reportFunction(report);
+        }
+
+        stopLock.lock();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmWatchdog::updateSlowestTransitions(const Activity& finishedActivity, int64_t elapsed)
+{
+    std::lock_guard<std::mutex> lock(slowestMutex);
+
+    auto transitionIt = std::find_if(slowestTransitions.begin(), slowestTransitions.end(),
+        [&finishedActivity](const FcmSlowTransition& transition)
+        {
+            return transition.component == finishedActivity.component &&
+                   transition.type == finishedActivity.type &&
+                   transition.state == *finishedActivity.state &&
+                   transition.interfaceName == *finishedActivity.interfaceName &&
+                   transition.messageName == *finishedActivity.messageName;
+        });
+
+    if (transitionIt != slowestTransitions.end())
+    {
+        transitionIt->maxElapsed = std::max(transitionIt->maxElapsed, elapsed);
+    }
+    else
+    {
+        if (slowestTransitions.size() >= topCount)
+        {
+            if (topCount == 0 || slowestTransitions.back().maxElapsed >= elapsed)
+            {
+                return;
+            }
+            slowestTransitions.pop_back();
+        }
+
+        slowestTransitions.push_back(FcmSlowTransition{finishedActivity.component,
+                                                       finishedActivity.component->name,
+                                                       *finishedActivity.state,
+                                                       *finishedActivity.interfaceName,
+                                                       *finishedActivity.messageName,
+                                                       finishedActivity.type,
+                                                       elapsed});
+    }
+
+    std::sort(slowestTransitions.begin(), slowestTransitions.end(),
+              [](const FcmSlowTransition& first, const FcmSlowTransition& second)
+              {
+                  return first.maxElapsed > second.maxElapsed;
+              });
+
+    // Until the list is full every finished activity is a candidate.
+    slowestThreshold.store(slowestTransitions.size() < topCount ? 0 : slowestTransitions.back().maxElapsed,
+                           std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmWatchdogReport FcmWatchdog::makeReport(const Activity& reportedActivity, int64_t elapsed) const
+{
+    FcmWatchdogReport report;
+    report.componentName = reportedActivity.component->name;
+    report.state = *reportedActivity.state;
+    report.interfaceName = *reportedActivity.interfaceName;
+    report.messageName = *reportedActivity.messageName;
+    report.type = reportedActivity.type;
+    report.elapsed = elapsed;
+    return report;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+std::vector<std::string> FcmWatchdog::sampleStack() const
+{
+    std::vector<std::string> stackSample;
+
+#ifdef FCM_WATCHDOG_STACK_SAMPLES
+    std::lock_guard<std::mutex> lock(samplingMutex);
+    stackDepth.store(-1, std::memory_order_relaxed);
+    samplePending.store(true, std::memory_order_release);
+    if (pthread_kill(deviceThread, installedSignal) != 0)
+    {
+        samplePending.store(false, std::memory_order_relaxed);
+        return stackSample;
+    }
+
+    // The device thread may not be scheduled right away.
+    auto deadline = Clock::now() + std::chrono::milliseconds(100);
+    while (stackDepth.load(std::memory_order_acquire) < 0)
+    {
+        if (Clock::now() > deadline)
+        {
+            samplePending.store(false, std::memory_order_relaxed);
+            return stackSample;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    int depth = stackDepth.load(std::memory_order_acquire);
+    char** symbols = backtrace_symbols(stackFrames, depth);
+    if (symbols != nullptr)
+    {
+        stackSample.assign(symbols, symbols + depth);
+        free(symbols);
+    }
+#endif
+
+    return stackSample;
+}
@@ -1,57 +1,119 @@
-#include <thread>
-
 #include "FcmWorkerHandler.h"
+#include "FcmTracer.h"
 
 // ---------------------------------------------------------------------------------------------------------------------
 FcmWorkerHandler::~FcmWorkerHandler()
+{
+    cancelAndWait();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmWorkerHandler::cancelAndWait()
 {
     cancel();
+
+    // The job refers to this handler, so it must have left run() before the handler is gone.
+    std::unique_lock<std::mutex> lock(jobMutex);
+    jobFinished.wait(lock, [this]() { return !jobRunning; });
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 bool FcmWorkerHandler::start()
 {
-    if (workerThread.joinable())
     {
-        logError("Worker: " + name + " already started");
-        return false;
+        std::lock_guard<std::mutex> lock(jobMutex);
+        if (jobRunning)
+        {
+            if (!cancelRequested)
+            {
+                logError("Worker: " + name + " already started");
+                return false;
+            }
+
+            // The cancelled job is still winding down, it will restart the job when it has finished.
+            restartRequested = true;
+            return true;
+        }
+
+        jobRunning = true;
+        cancelRequested = false;
     }
 
-    cancelRequested = false;
-    workerThread = std::thread(&FcmWorkerHandler::threadRun, this);
+    FcmWorkerPool::getInstance().submit([this]() { jobRun(); });
     return true;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
 void FcmWorkerHandler::cancel()
 {
-    cancelRequested = true;
-
-    if (workerThread.joinable())
     {
-        workerThread.join();
+        std::lock_guard<std::mutex> lock(jobMutex);
+        cancelRequested = true;
+        restartRequested = false;
     }
+    cancelCondition.notify_all();
 
-    auto checkFunction = [this](const std::shared_ptr<FcmMessage>& msg) -> bool
+    // Messages are only sent while holding the job mutex and when not cancelled, so they are either in the
+    // queue by now or will never be sent.
+    messageQueue.removeMessages([this](const std::shared_ptr<FcmMessage>& msg) -> bool
     {
         return msg->sender == this;
-    };
+    });
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool FcmWorkerHandler::waitUntilCancelled(std::chrono::steady_clock::time_point deadline)
+{
+    std::unique_lock<std::mutex> lock(jobMutex);
+    return cancelCondition.wait_until(lock, deadline, [this]() { return cancelRequested.load(); });
+}
 
-    messageQueue.removeMessage(finishedMessage->getInterfaceName(),
-                               finishedMessage->getName(),
-                               checkFunction);
+// ---------------------------------------------------------------------------------------------------------------------
+bool FcmWorkerHandler::sendPartialMessage(const std::shared_ptr<FcmMessage>& message)
+{
+    std::lock_guard<std::mutex> lock(jobMutex);
+    if (cancelRequested)
+    {
+        return false;
+    }
+
+    sendMessage(message);
+    return true;
 }
 
 // ---------------------------------------------------------------------------------------------------------------------
-void FcmWorkerHandler::threadRun()
+void FcmWorkerHandler::jobRun()
 {
+    auto& tracer = FcmTracer::getInstance();
+    bool tracing = tracer.isEnabled();
+    auto startTime = tracing ? FcmTracer::Clock::now() : FcmTracer::Clock::time_point();
+
     run();
+    runFinished();
 
-    if (cancelRequested)
+    if (tracing)
     {
-        return;
+        tracer.traceSlice(name, "worker", startTime, FcmTracer::Clock::now());
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        if (!cancelRequested)
+        {
+            finishedMessage = prepareFinishedMessage();
+            sendMessage(finishedMessage);
+        }
+
+        if (!restartRequested)
+        {
+            jobRunning = false;
+            jobFinished.notify_all();
+            return;
+        }
+
+        restartRequested = false;
+        cancelRequested = false;
     }
 
-    finishedMessage = prepareFinishedMessage();
-    sendMessage(finishedMessage);
+    FcmWorkerPool::getInstance().submit([this]() { jobRun(); });
 }
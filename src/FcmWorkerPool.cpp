@@ -0,0 +1,123 @@
+#include <string>
+#include <algorithm>
+
+#include "FcmWorkerPool.h"
+#include "FcmTracer.h"
+
+namespace
+{
+    // Pool and queue index of the calling thread, set for the threads of a pool.
+    thread_local const FcmWorkerPool* currentPool = nullptr;
+    thread_local size_t currentQueueIndex = 0;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmWorkerPool::FcmWorkerPool(size_t threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (size_t index = 0; index < threadCount; index++)
+    {
+        workQueues.push_back(std::make_unique<WorkQueue>());
+    }
+
+    for (size_t index = 0; index < threadCount; index++)
+    {
+        threads.emplace_back(&FcmWorkerPool::threadRun, this, index);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+FcmWorkerPool::~FcmWorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    sleepCondition.notify_all();
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmWorkerPool::submit(FcmJob job)
+{
+    // Jobs submitted from a pool thread stay on that thread's queue, others are distributed round-robin.
+    size_t index = currentPool == this ?
+                   currentQueueIndex :
+                   nextQueue.fetch_add(1, std::memory_order_relaxed) % workQueues.size();
+
+    pendingJobs.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(workQueues[index]->mutex);
+        workQueues[index]->jobs.push_back(std::move(job));
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    sleepCondition.notify_one();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+bool FcmWorkerPool::popJob(size_t index, FcmJob& job)
+{
+    // Take the most recent job from the own queue.
+    {
+        auto& ownQueue = *workQueues[index];
+        std::lock_guard<std::mutex> lock(ownQueue.mutex);
+        if (!ownQueue.jobs.empty())
+        {
+            job = std::move(ownQueue.jobs.back());
+            ownQueue.jobs.pop_back();
+            pendingJobs.fetch_sub(1);
+            return true;
+        }
+    }
+
+    // Steal the oldest job from one of the other queues.
+    for (size_t offset = 1; offset < workQueues.size(); offset++)
+    {
+        auto& victimQueue = *workQueues[(index + offset) % workQueues.size()];
+        std::lock_guard<std::mutex> lock(victimQueue.mutex);
+        if (!victimQueue.jobs.empty())
+        {
+            job = std::move(victimQueue.jobs.front());
+            victimQueue.jobs.pop_front();
+            pendingJobs.fetch_sub(1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------
+void FcmWorkerPool::threadRun(size_t index)
+{
+    currentPool = this;
+    currentQueueIndex = index;
+    FcmTracer::getInstance().nameThread("Worker " + std::to_string(index));
+
+    while (true)
+    {
+        FcmJob job;
+        if (popJob(index, job))
+        {
+            job();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCondition.wait(lock, [this]() { return stopping || pendingJobs.load() > 0; });
+        if (stopping && pendingJobs.load() == 0)
+        {
+            return;
+        }
+    }
+}